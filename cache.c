@@ -0,0 +1,611 @@
+/*
+*  cache.c - Implementacao da cache de setores (buffer cache) entre o sistema
+*            de arquivos e o disco
+*
+*  Autores: Hugo Ricardo Giles Nicolau - 202435003 e Thaíse Silva Alves - 202435038
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cache.h"
+
+#define CACHE_HASHSIZE 509	//Numero de listas da tabela hash (primo)
+#define CACHE_MAXRUN 64		//Maximo de setores por transferencia agrupada
+
+//Entrada da cache: um setor de um disco
+typedef struct cache_entry {
+	Disk *d;			//Disco ao qual pertence o setor
+	unsigned long addr;		//Endereco LBA do setor
+	int dirty;			//Setor modificado e ainda nao gravado
+	unsigned char data[DISK_SECTORDATASIZE];
+	struct cache_entry *prev;	//Lista LRU: entrada mais recente
+	struct cache_entry *next;	//Lista LRU: entrada mais antiga
+	struct cache_entry *hnext;	//Proxima entrada na lista da hash
+} CacheEntry;
+
+//Cache de um disco. Cada disco tem suas proprias entradas, lista LRU e
+//exclusao mutua, de modo que discos distintos sao atendidos concorrentemente
+typedef struct cache_set {
+	Disk *d;			//Disco atendido
+	pthread_mutex_t lock;		//Exclusao mutua sobre a cache do disco
+	CacheEntry entries[CACHE_NUMENTRIES];
+	CacheEntry *hashTable[CACHE_HASHSIZE];
+	CacheEntry *lruHead;		//Entrada usada mais recentemente
+	CacheEntry *lruTail;		//Entrada usada ha mais tempo
+	CacheStats stats;		//Contadores de uso
+	struct cache_set *next;		//Cache do proximo disco
+} CacheSet;
+
+static CacheSet *sets = NULL;		//Caches de todos os discos ja' usados
+static pthread_mutex_t setsLock = PTHREAD_MUTEX_INITIALIZER;
+
+//Funcao interna que calcula a posicao de um setor na tabela hash
+static unsigned int __cacheHash (unsigned long addr) {
+	return (unsigned int) (addr % CACHE_HASHSIZE);
+}
+
+//Funcao interna que retira uma entrada da lista LRU
+static void __cacheUnlinkLRU (CacheSet *c, CacheEntry *e) {
+	if (e->prev) e->prev->next = e->next;
+	else c->lruHead = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else c->lruTail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+//Funcao interna que insere uma entrada no inicio (mais recente) da lista LRU
+static void __cachePushLRU (CacheSet *c, CacheEntry *e) {
+	e->prev = NULL;
+	e->next = c->lruHead;
+	if (c->lruHead) c->lruHead->prev = e;
+	c->lruHead = e;
+	if (!c->lruTail) c->lruTail = e;
+}
+
+//Funcao interna que retira uma entrada da tabela hash
+static void __cacheUnhash (CacheSet *c, CacheEntry *e) {
+	CacheEntry **p = &c->hashTable[__cacheHash (e->addr)];
+	while (*p && *p != e) p = &(*p)->hnext;
+	if (*p) *p = e->hnext;
+	e->hnext = NULL;
+}
+
+//Funcao interna que retorna, com sua exclusao mutua obtida, a cache do disco
+//d, criando-a no primeiro uso. Todas as entradas de uma nova cache comecam
+//livres (d == NULL), encadeadas na lista LRU. Retorna NULL se faltar memoria
+static CacheSet* __cacheAcquire (Disk *d) {
+	CacheSet *c;
+	pthread_mutex_lock (&setsLock);
+	for (c = sets; c && c->d != d; c = c->next);
+	if (!c) {
+		c = calloc (1, sizeof (CacheSet));
+		if (c) {
+			c->d = d;
+			pthread_mutex_init (&c->lock, NULL);
+			for (int i = 0; i < CACHE_NUMENTRIES; i++)
+				__cachePushLRU (c, &c->entries[i]);
+			c->next = sets;
+			sets = c;
+		}
+	}
+	pthread_mutex_unlock (&setsLock);
+	if (c) pthread_mutex_lock (&c->lock);
+	return c;
+}
+
+//Funcao interna que libera a exclusao mutua da cache de um disco
+static void __cacheRelinquish (CacheSet *c) {
+	pthread_mutex_unlock (&c->lock);
+}
+
+//Funcao interna que retorna a primeira cache da lista de caches de discos
+static CacheSet* __cacheFirstSet (void) {
+	CacheSet *c;
+	pthread_mutex_lock (&setsLock);
+	c = sets;
+	pthread_mutex_unlock (&setsLock);
+	return c;
+}
+
+//Funcao interna que procura um setor na cache. Retorna NULL se ausente
+static CacheEntry* __cacheLookup (CacheSet *c, unsigned long addr) {
+	CacheEntry *e = c->hashTable[__cacheHash (addr)];
+	while (e && e->addr != addr) e = e->hnext;
+	return e;
+}
+
+//Funcao interna que devolve uma entrada ao conjunto de entradas livres,
+//posicionando-a no fim da lista LRU para que seja a primeira reutilizada
+static void __cacheRelease (CacheSet *c, CacheEntry *e) {
+	if (e->d) __cacheUnhash (c, e);
+	e->d = NULL;
+	e->dirty = 0;
+	__cacheUnlinkLRU (c, e);
+	e->prev = c->lruTail;
+	if (c->lruTail) c->lruTail->next = e;
+	else c->lruHead = e;
+	c->lruTail = e;
+}
+
+//Funcao interna que submete numIOs requisicoes ao disco d e aguarda sua
+//conclusao. Passando pela fila do disco, as transferencias sao ordenadas e
+//agrupadas pelo escalonador. Retorna 0 se todas foram bem sucedidas e -1
+//caso contrario
+static int __cacheTransfer (Disk *d, DiskIO *ios, int numIOs) {
+	DiskIO *submit[CACHE_MAXRUN];
+	int ret = 0;
+	for (int i = 0; i < numIOs; i++) submit[i] = &ios[i];
+	if (diskSubmit (d, submit, numIOs) < 0) return -1;
+	for (int i = 0; i < numIOs; i++) diskWaitCompletion (d);
+	for (int i = 0; i < numIOs; i++)
+		if (ios[i].status < 0) ret = -1;
+	return ret;
+}
+
+//Funcao interna que grava no disco o setor sujo da entrada e junto aos
+//setores sujos contiguos a ele (ate' CACHE_MAXRUN), submetidos como um unico
+//lote para que o escalonador os agrupe em uma transferencia. Os setores
+//gravados permanecem na cache, limpos. Retorna 0 se bem sucedida e -1 caso
+//contrario
+static int __cacheWriteBackRun (CacheSet *c, CacheEntry *e) {
+	CacheEntry *run[CACHE_MAXRUN], *x;
+	DiskIO ios[CACHE_MAXRUN];
+	unsigned long first = e->addr, n = 1;
+	while (n < CACHE_MAXRUN && first > 0
+	       && (x = __cacheLookup (c, first - 1)) && x->dirty) {
+		first--;
+		n++;
+	}
+	while (n < CACHE_MAXRUN
+	       && (x = __cacheLookup (c, first + n)) && x->dirty)
+		n++;
+	for (unsigned long k = 0; k < n; k++) {
+		run[k] = __cacheLookup (c, first + k);
+		memset (&ios[k], 0, sizeof (DiskIO));
+		ios[k].write = 1;
+		ios[k].addr = first + k;
+		ios[k].numSectors = 1;
+		ios[k].data = run[k]->data;
+	}
+	if (__cacheTransfer (c->d, ios, n) < 0) return -1;
+	for (unsigned long k = 0; k < n; k++) run[k]->dirty = 0;
+	c->stats.writebacks += n;
+	return 0;
+}
+
+//Funcao interna que obtem uma entrada para um novo setor, descartando a
+//entrada menos recentemente usada. Setores sujos sao gravados antes do
+//descarte, junto aos setores sujos contiguos. A entrada obtida passa ao
+//inicio da lista LRU. Retorna NULL se a gravacao falhar
+static CacheEntry* __cacheGetVictim (CacheSet *c) {
+	CacheEntry *e = c->lruTail;
+	if (e->d) {
+		if (e->dirty && __cacheWriteBackRun (c, e) < 0) return NULL;
+		__cacheUnhash (c, e);
+		c->stats.evictions++;
+	}
+	e->d = NULL;
+	e->dirty = 0;
+	__cacheUnlinkLRU (c, e);
+	__cachePushLRU (c, e);
+	return e;
+}
+
+//Funcao interna que associa uma entrada livre a um setor do disco da cache
+static void __cacheInsert (CacheSet *c, CacheEntry *e, unsigned long addr) {
+	unsigned int h = __cacheHash (addr);
+	e->d = c->d;
+	e->addr = addr;
+	e->hnext = c->hashTable[h];
+	c->hashTable[h] = e;
+}
+
+//Funcao interna que carrega na cache uma faixa de numSectors setores ausentes
+//a partir de addr, submetida de uma vez a' fila do disco (que a agrupa em uma
+//unica transferencia), copiando os dados tambem para *data. Retorna 0 se bem
+//sucedida e -1 caso contrario
+static int __cacheFillRun (CacheSet *c, unsigned long addr,
+                           unsigned long numSectors, unsigned char *data) {
+	CacheEntry *run[CACHE_MAXRUN];
+	DiskIO ios[CACHE_MAXRUN];
+	for (unsigned long k = 0; k < numSectors; k++) {
+		run[k] = __cacheGetVictim (c);
+		if (!run[k]) {
+			while (k > 0) __cacheRelease (c, run[--k]);
+			return -1;
+		}
+		memset (&ios[k], 0, sizeof (DiskIO));
+		ios[k].addr = addr + k;
+		ios[k].numSectors = 1;
+		ios[k].data = run[k]->data;
+	}
+	if (__cacheTransfer (c->d, ios, numSectors) < 0) {
+		for (unsigned long k = 0; k < numSectors; k++)
+			__cacheRelease (c, run[k]);
+		return -1;
+	}
+	for (unsigned long k = 0; k < numSectors; k++) {
+		__cacheInsert (c, run[k], addr + k);
+		memcpy (data + k * DISK_SECTORDATASIZE, run[k]->data,
+		        DISK_SECTORDATASIZE);
+	}
+	return 0;
+}
+
+//Funcao para a leitura de um setor (addr) de um disco por meio da cache. Os
+//dados sao transferidos para *data. Retorna 0 se a leitura ocorreu sem erros
+//e -1 caso contrario
+int cacheReadSector (Disk *d, unsigned long addr, unsigned char *data) {
+	return cacheReadSectors (d, addr, 1, data);
+}
+
+//Funcao para a leitura de numSectors setores contiguos a partir de addr por
+//meio da cache. Setores ausentes e contiguos sao lidos do disco em uma unica
+//transferencia. Retorna 0 se a leitura ocorreu sem erros e -1 caso contrario
+int cacheReadSectors (Disk *d, unsigned long addr, unsigned long numSectors,
+                      unsigned char *data) {
+	unsigned long k = 0;
+	int ret = 0;
+	CacheSet *c;
+	if (addr >= diskGetNumSectors (d)
+	    || numSectors > diskGetNumSectors (d) - addr)
+		return -1;
+	c = __cacheAcquire (d);
+	if (!c) return -1;
+	while (k < numSectors) {
+		CacheEntry *e = __cacheLookup (c, addr + k);
+		unsigned long run = 0;
+		if (e) {
+			c->stats.hits++;
+			__cacheUnlinkLRU (c, e);
+			__cachePushLRU (c, e);
+			memcpy (data + k * DISK_SECTORDATASIZE, e->data,
+			        DISK_SECTORDATASIZE);
+			k++;
+			continue;
+		}
+		//Agrupando setores ausentes consecutivos
+		while (k + run < numSectors && run < CACHE_MAXRUN
+		       && (run == 0 || !__cacheLookup (c, addr + k + run)))
+			run++;
+		c->stats.misses += run;
+		if (__cacheFillRun (c, addr + k, run,
+		                    data + k * DISK_SECTORDATASIZE) < 0) {
+			ret = -1;
+			break;
+		}
+		k += run;
+	}
+	__cacheRelinquish (c);
+	return ret;
+}
+
+//Funcao para a leitura em lote de numRanges faixas de setores de um disco por
+//meio da cache. Os setores ausentes de todas as faixas sao submetidos juntos
+//ao disco como E/S assincrona, para que sejam atendidos em um unico lote
+//pelo escalonador, e instalados na cache apos a conclusao. Retorna 0 se todas
+//as leituras ocorreram sem erros e -1 caso contrario
+int cacheReadRanges (Disk *d, CacheRange *ranges, int numRanges) {
+	DiskIO *ios = NULL, **submit = NULL;
+	unsigned char *scratch = NULL, *next;
+	unsigned long scratchSectors = 0;
+	int numIOs = 0, capIOs = 0, ret = 0;
+	CacheSet *c = __cacheAcquire (d);
+	if (!c) return -1;
+
+	//Faixas de leitura antecipada (sem destino) sao lidas em area auxiliar
+	for (int r = 0; r < numRanges; r++)
+		if (!ranges[r].data) scratchSectors += ranges[r].numSectors;
+	if (scratchSectors) {
+		scratch = malloc (scratchSectors * DISK_SECTORDATASIZE);
+		if (!scratch) {
+			ret = -1;
+			goto out;
+		}
+	}
+	next = scratch;
+
+	for (int r = 0; r < numRanges; r++) {
+		unsigned long addr = ranges[r].addr, k = 0;
+		int prefetch = !ranges[r].data;
+		unsigned char *base = prefetch ? next : ranges[r].data;
+		if (addr >= diskGetNumSectors (d)
+		    || ranges[r].numSectors > diskGetNumSectors (d) - addr) {
+			ret = -1;
+			goto out;
+		}
+		if (prefetch) next += ranges[r].numSectors * DISK_SECTORDATASIZE;
+		while (k < ranges[r].numSectors) {
+			CacheEntry *e = __cacheLookup (c, addr + k);
+			unsigned char *data = base + k * DISK_SECTORDATASIZE;
+			unsigned long run = 0;
+			if (e) {
+				if (!prefetch) {
+					c->stats.hits++;
+					__cacheUnlinkLRU (c, e);
+					__cachePushLRU (c, e);
+					memcpy (data, e->data,
+					        DISK_SECTORDATASIZE);
+				}
+				k++;
+				continue;
+			}
+			while (k + run < ranges[r].numSectors
+			       && (run == 0
+			           || !__cacheLookup (c, addr + k + run)))
+				run++;
+			if (prefetch) c->stats.prefetches += run;
+			else c->stats.misses += run;
+			if (numIOs == capIOs) {
+				DiskIO *n;
+				capIOs = (capIOs ? 2 * capIOs : 16);
+				n = realloc (ios, capIOs * sizeof (DiskIO));
+				if (!n) {
+					ret = -1;
+					goto out;
+				}
+				ios = n;
+			}
+			memset (&ios[numIOs], 0, sizeof (DiskIO));
+			ios[numIOs].addr = addr + k;
+			ios[numIOs].numSectors = run;
+			ios[numIOs].data = data;
+			numIOs++;
+			k += run;
+		}
+	}
+	if (numIOs == 0) goto out;
+
+	submit = malloc (numIOs * sizeof (DiskIO*));
+	if (!submit) {
+		ret = -1;
+		goto out;
+	}
+	for (int i = 0; i < numIOs; i++) submit[i] = &ios[i];
+	if (diskSubmit (d, submit, numIOs) < 0) {
+		ret = -1;
+		goto out;
+	}
+	for (int i = 0; i < numIOs; i++) diskWaitCompletion (d);
+
+	//Instalando na cache os setores lidos
+	for (int i = 0; i < numIOs; i++) {
+		if (ios[i].status < 0) {
+			ret = -1;
+			continue;
+		}
+		for (unsigned long k = 0; k < ios[i].numSectors; k++) {
+			CacheEntry *e;
+			if (__cacheLookup (c, ios[i].addr + k)) continue;
+			e = __cacheGetVictim (c);
+			if (!e) {
+				ret = -1;
+				break;
+			}
+			__cacheInsert (c, e, ios[i].addr + k);
+			memcpy (e->data, ios[i].data + k * DISK_SECTORDATASIZE,
+			        DISK_SECTORDATASIZE);
+		}
+	}
+out:
+	__cacheRelinquish (c);
+	free (submit);
+	free (ios);
+	free (scratch);
+	return ret;
+}
+
+//Funcao para a escrita de um setor (addr) de um disco por meio da cache. O
+//setor e' apenas marcado como sujo, sendo gravado no disco quando descartado
+//ou em cacheSync. Retorna 0 se bem sucedido e -1 caso contrario
+int cacheWriteSector (Disk *d, unsigned long addr, unsigned char *data) {
+	return cacheWriteSectors (d, addr, 1, data);
+}
+
+//Funcao para a escrita de numSectors setores contiguos a partir de addr por
+//meio da cache. Os setores sao marcados como sujos. Retorna 0 se bem sucedido
+//e -1 caso contrario
+int cacheWriteSectors (Disk *d, unsigned long addr, unsigned long numSectors,
+                       unsigned char *data) {
+	int ret = 0;
+	CacheSet *c;
+	if (addr >= diskGetNumSectors (d)
+	    || numSectors > diskGetNumSectors (d) - addr)
+		return -1;
+	c = __cacheAcquire (d);
+	if (!c) return -1;
+	for (unsigned long k = 0; k < numSectors; k++) {
+		CacheEntry *e = __cacheLookup (c, addr + k);
+		if (e) {
+			c->stats.hits++;
+			__cacheUnlinkLRU (c, e);
+			__cachePushLRU (c, e);
+		}
+		else {
+			c->stats.misses++;
+			e = __cacheGetVictim (c);
+			if (!e) {
+				ret = -1;
+				break;
+			}
+			__cacheInsert (c, e, addr + k);
+		}
+		memcpy (e->data, data + k * DISK_SECTORDATASIZE,
+		        DISK_SECTORDATASIZE);
+		e->dirty = 1;
+	}
+	__cacheRelinquish (c);
+	return ret;
+}
+
+//Funcao interna que submete ao disco, como um unico lote de E/S assincrona,
+//os setores sujos da cache c, cuja exclusao mutua deve estar obtida. O
+//escalonador do disco os ordena e agrupa setores contiguos. Os setores
+//submetidos sao registrados em ios e owner. Retorna o numero de setores
+//submetidos ou -1 em caso de falha
+static int __cacheSubmitDirty (CacheSet *c, DiskIO *ios, CacheEntry **owner) {
+	DiskIO *submit[CACHE_NUMENTRIES];
+	int n = 0;
+	for (int i = 0; i < CACHE_NUMENTRIES; i++) {
+		if (!c->entries[i].d || !c->entries[i].dirty) continue;
+		memset (&ios[n], 0, sizeof (DiskIO));
+		ios[n].write = 1;
+		ios[n].addr = c->entries[i].addr;
+		ios[n].numSectors = 1;
+		ios[n].data = c->entries[i].data;
+		owner[n] = &c->entries[i];
+		submit[n] = &ios[n];
+		n++;
+	}
+	if (n && diskSubmit (c->d, submit, n) < 0) return -1;
+	return n;
+}
+
+//Funcao interna que aguarda os n setores submetidos por __cacheSubmitDirty,
+//marcando como limpos os gravados com sucesso. Retorna 0 se todos foram
+//gravados e -1 caso contrario
+static int __cacheCompleteDirty (CacheSet *c, DiskIO *ios, CacheEntry **owner,
+                                 int n) {
+	int ret = 0;
+	for (int i = 0; i < n; i++) diskWaitCompletion (c->d);
+	for (int i = 0; i < n; i++) {
+		if (ios[i].status < 0) {
+			ret = -1;
+			continue;
+		}
+		owner[i]->dirty = 0;
+		c->stats.writebacks++;
+	}
+	return ret;
+}
+
+//Funcao que grava no disco todos os setores sujos de d mantidos na cache.
+//Os setores sao submetidos de uma vez ao disco, de modo que o escalonador os
+//ordene e agrupe setores contiguos em uma unica escrita. Retorna 0 se bem
+//sucedido e -1 caso contrario
+int cacheSync (Disk *d) {
+	DiskIO ios[CACHE_NUMENTRIES];
+	CacheEntry *owner[CACHE_NUMENTRIES];
+	CacheSet *c;
+	int n, ret;
+	if (!d) return -1;
+	c = __cacheAcquire (d);
+	if (!c) return -1;
+	n = __cacheSubmitDirty (c, ios, owner);
+	ret = (n < 0 ? -1 : __cacheCompleteDirty (c, ios, owner, n));
+	__cacheRelinquish (c);
+	return ret;
+}
+
+//Funcao que grava no disco os setores sujos de todos os discos mantidos na
+//cache. Os lotes de todos os discos sao submetidos antes de qualquer espera,
+//de modo que os discos sejam atendidos em paralelo por suas threads. Retorna
+//0 se bem sucedido e -1 caso contrario
+int cacheSyncAll (void) {
+	int ret = 0;
+	int numSets = 0;
+	CacheSet *first = __cacheFirstSet (), *c;
+	DiskIO (*ios)[CACHE_NUMENTRIES];
+	CacheEntry *(*owner)[CACHE_NUMENTRIES];
+	int *pending;
+
+	for (c = first; c; c = c->next) numSets++;
+	if (!numSets) return 0;
+	ios = malloc (numSets * sizeof (*ios));
+	owner = malloc (numSets * sizeof (*owner));
+	pending = malloc (numSets * sizeof (int));
+	if (!ios || !owner || !pending) {
+		free (ios);
+		free (owner);
+		free (pending);
+		return -1;
+	}
+
+	//Caches sao percorridas sempre na mesma ordem, mantendo suas exclusoes
+	//mutuas ate' o fim das gravacoes
+	c = first;
+	for (int k = 0; k < numSets; k++, c = c->next) {
+		pthread_mutex_lock (&c->lock);
+		pending[k] = __cacheSubmitDirty (c, ios[k], owner[k]);
+		if (pending[k] < 0) {
+			pending[k] = 0;
+			ret = -1;
+		}
+	}
+	c = first;
+	for (int k = 0; k < numSets; k++, c = c->next) {
+		if (__cacheCompleteDirty (c, ios[k], owner[k], pending[k]) < 0)
+			ret = -1;
+		__cacheRelinquish (c);
+	}
+	free (ios);
+	free (owner);
+	free (pending);
+	return ret;
+}
+
+//Funcao que descarta todos os setores de d mantidos na cache, sem grava-los.
+//Deve ser precedida por cacheSync para que nao haja perda de dados
+void cacheInvalidate (Disk *d) {
+	CacheSet *c = __cacheAcquire (d);
+	if (!c) return;
+	for (int i = 0; i < CACHE_NUMENTRIES; i++)
+		if (c->entries[i].d) __cacheRelease (c, &c->entries[i]);
+	__cacheRelinquish (c);
+}
+
+//Funcao que copia para *data o setor addr de d, se presente na cache, sem
+//le-lo do disco e sem alterar a ordem LRU. Retorna 1 se o setor estava na
+//cache e 0 caso contrario
+int cachePeekSector (Disk *d, unsigned long addr, unsigned char *data) {
+	CacheEntry *e;
+	CacheSet *c = __cacheAcquire (d);
+	if (!c) return 0;
+	e = __cacheLookup (c, addr);
+	if (e) memcpy (data, e->data, DISK_SECTORDATASIZE);
+	__cacheRelinquish (c);
+	return (e != NULL);
+}
+
+//Funcao que descarta da cache, sem grava-los, os setores de d na faixa de
+//numSectors setores a partir de addr. Usada quando a faixa sera' sobrescrita
+//diretamente no disco
+void cacheDiscard (Disk *d, unsigned long addr, unsigned long numSectors) {
+	CacheSet *c = __cacheAcquire (d);
+	if (!c) return;
+	for (unsigned long k = 0; k < numSectors; k++) {
+		CacheEntry *e = __cacheLookup (c, addr + k);
+		if (e) __cacheRelease (c, e);
+	}
+	__cacheRelinquish (c);
+}
+
+//Funcao que copia para *stats os contadores de uso da cache, somados sobre
+//todos os discos
+void cacheGetStats (CacheStats *s) {
+	if (!s) return;
+	memset (s, 0, sizeof (CacheStats));
+	for (CacheSet *c = __cacheFirstSet (); c; c = c->next) {
+		pthread_mutex_lock (&c->lock);
+		s->hits += c->stats.hits;
+		s->misses += c->stats.misses;
+		s->evictions += c->stats.evictions;
+		s->writebacks += c->stats.writebacks;
+		s->prefetches += c->stats.prefetches;
+		pthread_mutex_unlock (&c->lock);
+	}
+}
+
+//Funcao que zera os contadores de uso da cache
+void cacheResetStats (void) {
+	for (CacheSet *c = __cacheFirstSet (); c; c = c->next) {
+		pthread_mutex_lock (&c->lock);
+		memset (&c->stats, 0, sizeof (CacheStats));
+		pthread_mutex_unlock (&c->lock);
+	}
+}
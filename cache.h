@@ -0,0 +1,97 @@
+/*
+*  cache.h - Definicao da cache de setores (buffer cache) entre o sistema de
+*            arquivos e o disco
+*
+*  Autores: Hugo Ricardo Giles Nicolau - 202435003 e Thaíse Silva Alves - 202435038
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "disk.h"
+
+//Numero de setores mantidos em memoria pela cache (LRU) de cada disco
+#define CACHE_NUMENTRIES 256
+
+//Contadores de uso da cache, para dimensionamento
+typedef struct cache_stats {
+	unsigned long hits;		//Acessos atendidos pela cache
+	unsigned long misses;		//Acessos que exigiram leitura do disco
+	unsigned long evictions;	//Setores descartados para dar lugar a outros
+	unsigned long writebacks;	//Setores sujos gravados no disco
+	unsigned long prefetches;	//Setores lidos por leitura antecipada
+} CacheStats;
+
+//Faixa de setores contiguos de um disco, para leituras em lote
+typedef struct cache_range {
+	unsigned long addr;		//Endereco LBA do primeiro setor
+	unsigned long numSectors;	//Numero de setores da faixa
+	unsigned char *data;		//Destino (numSectors * DISK_SECTORDATASIZE)
+					//ou NULL para leitura antecipada
+} CacheRange;
+
+//Funcao para a leitura de um setor (addr) de um disco por meio da cache. Os
+//dados sao transferidos para *data. Retorna 0 se a leitura ocorreu sem erros
+//e -1 caso contrario
+int cacheReadSector (Disk *d, unsigned long addr, unsigned char *data);
+
+//Funcao para a leitura de numSectors setores contiguos a partir de addr por
+//meio da cache. Setores ausentes e contiguos sao lidos do disco em uma unica
+//transferencia. Retorna 0 se a leitura ocorreu sem erros e -1 caso contrario
+int cacheReadSectors (Disk *d, unsigned long addr, unsigned long numSectors,
+                      unsigned char *data);
+
+//Funcao para a leitura em lote de numRanges faixas de setores de um disco por
+//meio da cache. Os setores ausentes de todas as faixas sao submetidos juntos
+//ao disco como E/S assincrona e atendidos em um unico lote pelo escalonador.
+//Faixas com data NULL sao apenas trazidas para a cache (leitura antecipada),
+//sem copia e sem alterar a ordem LRU dos setores ja' presentes. Retorna 0 se
+//todas as leituras ocorreram sem erros e -1 caso contrario
+int cacheReadRanges (Disk *d, CacheRange *ranges, int numRanges);
+
+//Funcao para a escrita de um setor (addr) de um disco por meio da cache. O
+//setor e' apenas marcado como sujo, sendo gravado no disco quando descartado
+//ou em cacheSync. Retorna 0 se bem sucedido e -1 caso contrario
+int cacheWriteSector (Disk *d, unsigned long addr, unsigned char *data);
+
+//Funcao para a escrita de numSectors setores contiguos a partir de addr por
+//meio da cache. Os setores sao marcados como sujos. Retorna 0 se bem sucedido
+//e -1 caso contrario
+int cacheWriteSectors (Disk *d, unsigned long addr, unsigned long numSectors,
+                       unsigned char *data);
+
+//Funcao que grava no disco todos os setores sujos de d mantidos na cache.
+//Setores contiguos sao agrupados em uma unica escrita. Retorna 0 se bem
+//sucedido e -1 caso contrario
+int cacheSync (Disk *d);
+
+//Funcao que grava no disco os setores sujos de todos os discos mantidos na
+//cache. Os discos sao atendidos em paralelo. Retorna 0 se bem sucedido e -1
+//caso contrario
+int cacheSyncAll (void);
+
+//Funcao que descarta todos os setores de d mantidos na cache, sem grava-los.
+//Deve ser precedida por cacheSync para que nao haja perda de dados
+void cacheInvalidate (Disk *d);
+
+//Funcao que copia para *data o setor addr de d, se presente na cache (limpo
+//ou sujo), sem le-lo do disco e sem alterar a ordem LRU. Retorna 1 se o setor
+//estava na cache e 0 caso contrario
+int cachePeekSector (Disk *d, unsigned long addr, unsigned char *data);
+
+//Funcao que descarta da cache, sem grava-los, os setores de d na faixa de
+//numSectors setores a partir de addr, tal como cacheInvalidate. Deve ser usada
+//apenas para faixas que serao sobrescritas diretamente no disco
+void cacheDiscard (Disk *d, unsigned long addr, unsigned long numSectors);
+
+//Funcao que copia os contadores de uso da cache para *stats
+void cacheGetStats (CacheStats *stats);
+
+//Funcao que zera os contadores de uso da cache
+void cacheResetStats (void);
+
+#endif
@@ -12,11 +12,18 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 #include "disk.h"
 
+#ifndef _WIN32
+#   include <sys/mman.h>
+#endif
+
 #define DISK_SEEKDELAY 10
 
 #define DISK_SECTORSPERTRACK 64
+#define DISK_CREATECHUNKTRACKS 32	//Trilhas gravadas por vez na criacao
 #define DISK_SECTORDATAOFFSET 3
 #define DISK_SECTORTOTALSIZE (2*DISK_SECTORDATAOFFSET+DISK_SECTORDATASIZE)
 
@@ -32,13 +39,51 @@ struct disk {
 	unsigned long numSectors;	//Numero de setores
 	unsigned long size;		//Espaco util total para dados no disco
 	unsigned long currCylinder;	//Cilindro atual 
+	int backend;			//Implementacao de E/S (DISK_BACKEND_*)
+	unsigned char *map;		//Mapeamento do arquivo (DISK_BACKEND_MMAP)
+	unsigned long mapSize;		//Tamanho do mapeamento, em bytes
+	int scheduler;			//Politica de escalonamento (DISK_SCHED_*)
+	struct disk_request *queue;	//Requisicoes pendentes de despacho
+	unsigned long queueLen;		//Numero de requisicoes pendentes
+	unsigned long queueCap;		//Capacidade alocada da fila
+	unsigned long seekDistance;	//Total de cilindros percorridos
+	int virtualClock;		//Atrasos apenas simulados, sem dormir
+	unsigned long clock;		//Tempo de disco acumulado, em ms
+	unsigned long lastOpTime;	//Tempo de disco da ultima operacao, em ms
+	pthread_mutex_t lock;		//Exclusao mutua sobre cabeca, arquivo e fila
+	pthread_mutex_t aioLock;	//Exclusao mutua sobre as filas assincronas
+	pthread_cond_t aioSubmitted;	//Sinaliza novas submissoes assincronas
+	pthread_cond_t aioCompleted;	//Sinaliza novas conclusoes assincronas
+	pthread_t worker;		//Thread que atende as submissoes
+	int workerRunning;		//Thread do disco criada
+	int workerStop;			//Pedido de encerramento da thread
+	DiskIO *submitHead, *submitTail;	//Submissoes ainda nao atendidas
+	DiskIO *doneHead, *doneTail;	//Conclusoes ainda nao recolhidas
+	unsigned long inFlight;		//Submissoes ainda nao recolhidas
+	DiskStats stats;		//Contadores de E/S
 };
 
+//Resultado de uma escrita substituida na fila por outra ao mesmo setor
+typedef struct disk_status {
+	int *status;			//Resultado da escrita substituida
+	struct disk_status *next;	//Proxima escrita substituida
+} DiskStatus;
+
+//Requisicao de E/S de um setor, pendente na fila de um disco
+typedef struct disk_request {
+	int write;			//1 para escrita, 0 para leitura
+	unsigned long addr;		//Endereco LBA do setor
+	unsigned char *data;		//Dados a gravar ou destino da leitura
+	int *status;			//Resultado (-1 em erro), se nao NULL
+	DiskStatus *merged;		//Escritas anteriores substituidas
+} DiskRequest;
+
 
 //Funcao interna, privada, para realizar o posicionamento
 //da cabeca sobre o setor desejado para leitura ou escrita
-//Insere um atraso a cada cilindro deslocado no percurso
-void __diskSeek(Disk *d, unsigned long addr) {
+//Insere um atraso a cada cilindro deslocado no percurso. Retorna a posicao,
+//no arquivo do disco, do inicio dos dados do setor
+unsigned long __diskSeek(Disk *d, unsigned long addr) {
 	unsigned long reqCyl, cylOffset;
 	unsigned long sectorPos = addr * DISK_SECTORTOTALSIZE;
 	unsigned long dataPos = sectorPos + DISK_SECTORDATAOFFSET;
@@ -48,11 +93,34 @@ void __diskSeek(Disk *d, unsigned long addr) {
                      ? d->currCylinder - reqCyl
 		     : reqCyl - d->currCylinder);
 
-	for (unsigned long i=1; i <= cylOffset; i++)
-		SLEEP (DISK_SEEKDELAY);
+	//No modo de relogio virtual o atraso e' apenas contabilizado
+	if (!d->virtualClock)
+		for (unsigned long i=1; i <= cylOffset; i++)
+			SLEEP (DISK_SEEKDELAY);
+	d->seekDistance += cylOffset;
+	d->stats.cylinders += cylOffset;
+	if (cylOffset) d->stats.seeks++;
+	d->lastOpTime = cylOffset * DISK_SEEKDELAY;
+	d->clock += d->lastOpTime;
 
-	fseek (d->fp, dataPos, 0);
+	if (d->backend == DISK_BACKEND_STDIO)
+		fseek (d->fp, dataPos, 0);
 	d->currCylinder = reqCyl;
+	return dataPos;
+}
+
+//Funcao interna que inicializa os mecanismos de sincronizacao de um disco.
+//A exclusao mutua sobre o disco e' recursiva, pois operacoes publicas podem
+//ser compostas por outras (ex.: despacho da fila durante um enfileiramento)
+void __diskInitLocks (Disk *d) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init (&attr);
+	pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init (&d->lock, &attr);
+	pthread_mutexattr_destroy (&attr);
+	pthread_mutex_init (&d->aioLock, NULL);
+	pthread_cond_init (&d->aioSubmitted, NULL);
+	pthread_cond_init (&d->aioCompleted, NULL);
 }
 
 //Funcao que conecta um disco fisico ao sistema operacional.
@@ -62,6 +130,14 @@ void __diskSeek(Disk *d, unsigned long addr) {
 //pelo sistema operacional. Se o disco existir, retorna um ponteiro para Disk.
 //Caso contrario, retorna NULL
 Disk* diskConnect(int id, char* rawDiskPath) {
+	return diskConnectBackend (id, rawDiskPath, DISK_BACKEND_STDIO);
+}
+
+//Funcao que conecta um disco fisico ao sistema operacional, tal como
+//diskConnect, escolhendo a implementacao de E/S sobre o arquivo do disco
+//(DISK_BACKEND_STDIO ou DISK_BACKEND_MMAP). Retorna NULL se o disco nao
+//existir ou se nao puder ser mapeado em memoria
+Disk* diskConnectBackend(int id, char* rawDiskPath, int backend) {
 	Disk* d = NULL;
 	FILE *fp = fopen(rawDiskPath,"r+");
 	if (fp!=NULL) {
@@ -73,17 +149,76 @@ Disk* diskConnect(int id, char* rawDiskPath) {
 		d->numCylinders = d->numSectors / DISK_SECTORSPERTRACK;
 		d->size = d->numSectors * DISK_SECTORDATASIZE;
 		d->currCylinder = 0;
+		d->backend = DISK_BACKEND_STDIO;
+		d->map = NULL;
+		d->mapSize = 0;
+		d->scheduler = DISK_SCHED_CLOOK;
+		d->queue = NULL;
+		d->queueLen = 0;
+		d->queueCap = 0;
+		d->seekDistance = 0;
+		d->virtualClock = 0;
+		d->clock = 0;
+		d->lastOpTime = 0;
+		d->workerRunning = 0;
+		d->workerStop = 0;
+		d->submitHead = d->submitTail = NULL;
+		d->doneHead = d->doneTail = NULL;
+		d->inFlight = 0;
+		memset (&d->stats, 0, sizeof (DiskStats));
+		__diskInitLocks (d);
+#ifndef _WIN32
+		if (backend == DISK_BACKEND_MMAP && d->numSectors > 0) {
+			void *map;
+			d->mapSize = d->numSectors * DISK_SECTORTOTALSIZE;
+			map = mmap (NULL, d->mapSize, PROT_READ | PROT_WRITE,
+			            MAP_SHARED, fileno (fp), 0);
+			if (map == MAP_FAILED) {
+				fclose (fp);
+				free (d);
+				return NULL;
+			}
+			d->map = map;
+			d->backend = DISK_BACKEND_MMAP;
+		}
+#endif
 	}
 	return d;
 }
 
 //Funcao que disconecta um disco fisico do sistema operacional
 int diskDisconnect(Disk* d) {
-	int result = fclose (d->fp);
+	int result;
+	//Encerrando a thread do disco apos atender as submissoes pendentes
+	if (d->workerRunning) {
+		pthread_mutex_lock (&d->aioLock);
+		d->workerStop = 1;
+		pthread_cond_signal (&d->aioSubmitted);
+		pthread_mutex_unlock (&d->aioLock);
+		pthread_join (d->worker, NULL);
+	}
+	result = diskDispatch (d);
+	free (d->queue);
+	pthread_mutex_destroy (&d->lock);
+	pthread_mutex_destroy (&d->aioLock);
+	pthread_cond_destroy (&d->aioSubmitted);
+	pthread_cond_destroy (&d->aioCompleted);
+#ifndef _WIN32
+	if (d->backend == DISK_BACKEND_MMAP) {
+		if (msync (d->map, d->mapSize, MS_SYNC) != 0) result = -1;
+		if (munmap (d->map, d->mapSize) != 0) result = -1;
+	}
+#endif
+	if (fclose (d->fp) != 0) result = -1;
 	free(d);
 	return result;
 }
 
+//Funcao que retorna a implementacao de E/S (DISK_BACKEND_*) usada por um disco
+int diskGetBackend (Disk* d) {
+	return d->backend;
+}
+
 //Funcao que retorna o identificador de um disco fisico, conforme atribuido
 //pelo sistema operacional no momento da conexao
 int diskGetId (Disk* d) {
@@ -109,7 +244,11 @@ unsigned long diskGetSize (Disk* d) {
 //Funcao que retorna o cilindro sobre o qual as cabecas estao atualmente
 //posicionadas em um disco
 unsigned long diskGetCurrentCylinder (Disk* d) {
-	return d->currCylinder;
+	unsigned long cyl;
+	pthread_mutex_lock (&d->lock);
+	cyl = d->currCylinder;
+	pthread_mutex_unlock (&d->lock);
+	return cyl;
 }
 
 //Funcao que escreve em *cyl o numero do cilindro correspondente a um endereco
@@ -120,46 +259,636 @@ int diskAddrToCylinder (Disk* d, unsigned long addr, unsigned long *cyl) {
 	return (addr < d->numSectors ? 0 : -1);
 }
 
+//Funcao interna, privada, que transfere numSectors setores contiguos a partir
+//do endereco addr, com um unico posicionamento da cabeca. O k-esimo setor e'
+//lido para (ou escrito a partir de) data[k]. Como os setores sao intercalados
+//com preambulo e ECC no arquivo do disco, a transferencia de mais de um setor
+//utiliza um buffer intermediario com a faixa completa, movida em uma unica
+//operacao de E/S. Deve ser chamada com a exclusao mutua do disco obtida.
+//Retorna 0 se bem sucedida e -1 caso contrario
+int __diskMoveSectors (Disk *d, unsigned long addr, unsigned long numSectors,
+                       unsigned char **data, int write) {
+	unsigned char *buffer;
+	unsigned long length, pos;
+	int ret = 0;
+
+	if (numSectors == 0) return 0;
+	if (addr >= d->numSectors || numSectors > d->numSectors - addr)
+		return -1;
+	pos = __diskSeek (d, addr);
+
+	//Arquivo mapeado em memoria: copia direta de cada setor, sem buffer
+	//intermediario e sem alterar preambulo e ECC
+	if (d->backend == DISK_BACKEND_MMAP) {
+		for (unsigned long k = 0; k < numSectors; k++) {
+			unsigned char *sector = d->map + pos
+			                        + k * DISK_SECTORTOTALSIZE;
+			if (write) memcpy (sector, data[k], DISK_SECTORDATASIZE);
+			else memcpy (data[k], sector, DISK_SECTORDATASIZE);
+		}
+		return 0;
+	}
+
+	if (numSectors == 1) {
+		if (write)
+			return (fwrite (data[0], 1, DISK_SECTORDATASIZE, d->fp)
+			        != DISK_SECTORDATASIZE ? -1 : 0);
+		return (fread (data[0], 1, DISK_SECTORDATASIZE, d->fp)
+		        != DISK_SECTORDATASIZE ? -1 : 0);
+	}
+
+	//Do inicio dos dados do primeiro setor ao fim dos dados do ultimo
+	length = (numSectors - 1) * DISK_SECTORTOTALSIZE + DISK_SECTORDATASIZE;
+	buffer = malloc (length);
+	if (!buffer) return -1;
+
+	if (write) {
+		for (unsigned long k = 0; k < numSectors; k++) {
+			unsigned char *pos = buffer + k * DISK_SECTORTOTALSIZE;
+			memcpy (pos, data[k], DISK_SECTORDATASIZE);
+			if (k == numSectors - 1) break;
+			memcpy (pos + DISK_SECTORDATASIZE, DISK_SECTORECC,
+			        DISK_SECTORDATAOFFSET);
+			memcpy (pos + DISK_SECTORDATASIZE + DISK_SECTORDATAOFFSET,
+			        DISK_SECTORPREAMBLE, DISK_SECTORDATAOFFSET);
+		}
+		if (fwrite (buffer, 1, length, d->fp) != length) ret = -1;
+	}
+	else {
+		if (fread (buffer, 1, length, d->fp) != length) ret = -1;
+		else
+			for (unsigned long k = 0; k < numSectors; k++)
+				memcpy (data[k], buffer + k * DISK_SECTORTOTALSIZE,
+				        DISK_SECTORDATASIZE);
+	}
+	free (buffer);
+	return ret;
+}
+
+//Funcao interna que retorna o instante atual, em microssegundos, de um relogio
+//monotonico do sistema hospedeiro
+unsigned long __diskNow (void) {
+#ifdef _WIN32
+	return (unsigned long) GetTickCount64 () * 1000;
+#else
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+#endif
+}
+
+//Funcao interna que contabiliza uma transferencia nos contadores do disco. A
+//latencia e' o tempo decorrido somado, no modo de relogio virtual, ao atraso
+//de posicionamento apenas simulado
+void __diskAccount (Disk *d, unsigned long numSectors, int write,
+                    unsigned long elapsed) {
+	int op = write ? DISK_OP_WRITE : DISK_OP_READ;
+	int bucket = 0;
+	if (d->virtualClock) elapsed += d->lastOpTime * 1000;
+	d->stats.ops[op]++;
+	d->stats.sectors[op] += numSectors;
+	if (d->backend == DISK_BACKEND_MMAP || numSectors == 1)
+		d->stats.bytes[op] += numSectors * DISK_SECTORDATASIZE;
+	else
+		d->stats.bytes[op] += (numSectors - 1) * DISK_SECTORTOTALSIZE
+		                      + DISK_SECTORDATASIZE;
+	d->stats.latencyTotal[op] += elapsed;
+	while (elapsed && bucket < DISK_LATENCY_BUCKETS - 1) {
+		elapsed >>= 1;
+		bucket++;
+	}
+	d->stats.latency[op][bucket]++;
+}
+
+//Funcao interna que realiza uma transferencia, contabilizando-a nos contadores
+//do disco. Deve ser chamada com a exclusao mutua do disco obtida. Retorna 0 se
+//bem sucedida e -1 caso contrario
+int __diskDoTransfer (Disk *d, unsigned long addr, unsigned long numSectors,
+                      unsigned char **data, int write) {
+	unsigned long start = __diskNow ();
+	int ret = __diskMoveSectors (d, addr, numSectors, data, write);
+	if (ret == 0 && numSectors > 0)
+		__diskAccount (d, numSectors, write, __diskNow () - start);
+	return ret;
+}
+
+//Funcao interna que realiza uma transferencia sob exclusao mutua do disco
+int __diskTransfer (Disk *d, unsigned long addr, unsigned long numSectors,
+                    unsigned char **data, int write) {
+	int ret;
+	pthread_mutex_lock (&d->lock);
+	ret = __diskDoTransfer (d, addr, numSectors, data, write);
+	pthread_mutex_unlock (&d->lock);
+	return ret;
+}
+
+//Funcao interna que monta o vetor de ponteiros para numSectors setores
+//armazenados em sequencia em data e realiza a transferencia
+int __diskTransferRange (Disk *d, unsigned long addr, unsigned long numSectors,
+                         unsigned char *data, int write) {
+	unsigned char **sectors;
+	int ret;
+	if (numSectors == 1) return __diskTransfer (d, addr, 1, &data, write);
+	sectors = malloc (numSectors * sizeof (unsigned char*));
+	if (!sectors) return -1;
+	for (unsigned long k = 0; k < numSectors; k++)
+		sectors[k] = data + k * DISK_SECTORDATASIZE;
+	ret = __diskTransfer (d, addr, numSectors, sectors, write);
+	free (sectors);
+	return ret;
+}
+
 //Funcao para realizar a leitura de um setor identificado pelo endereco LBA
 //(addr). Os dados sao transferidos para *data. Retorna 0 se a leitura ocorreu
 //sem erros e -1 caso contrario
 int diskReadSector (Disk* d, unsigned long addr, unsigned char *data) {
-	if (addr >= d->numSectors) return -1;
-	__diskSeek (d,addr);
-	if (fread (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
-		return -1;
-	return 0;
+	return __diskTransfer (d, addr, 1, &data, 0);
 }
 
 //Funcao para realzar a escrita de um setor identificado pelo endereco LBA
 //(addr). Os dados sao transferidos a partir de *data. Retorna 0 se a leitura
 //ocorreu sem erros e -1 caso contrario
 int diskWriteSector (Disk* d, unsigned long addr, unsigned char* data) {
-	if (addr >= d->numSectors) return -1;
-	__diskSeek (d,addr);
-	if (fwrite (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
+	return __diskTransfer (d, addr, 1, &data, 1);
+}
+
+//Funcao para realizar a leitura de numSectors setores contiguos a partir do
+//endereco LBA addr, com um unico posicionamento da cabeca e uma unica operacao
+//de E/S no arquivo do disco. Os dados sao transferidos, em sequencia, para
+//*data. Retorna 0 se a leitura ocorreu sem erros e -1 caso contrario
+int diskReadSectors (Disk* d, unsigned long addr, unsigned long numSectors,
+                     unsigned char* data) {
+	return __diskTransferRange (d, addr, numSectors, data, 0);
+}
+
+//Funcao para realizar a escrita de numSectors setores contiguos a partir do
+//endereco LBA addr, com um unico posicionamento da cabeca e uma unica operacao
+//de E/S no arquivo do disco. Os dados sao transferidos, em sequencia, a partir
+//de *data. Retorna 0 se a escrita ocorreu sem erros e -1 caso contrario
+int diskWriteSectors (Disk* d, unsigned long addr, unsigned long numSectors,
+                      unsigned char* data) {
+	return __diskTransferRange (d, addr, numSectors, data, 1);
+}
+
+//Funcao de leitura com dispersao (scatter): le numSectors setores contiguos
+//a partir do endereco LBA addr, copiando o k-esimo setor para data[k].
+//Retorna 0 se a leitura ocorreu sem erros e -1 caso contrario
+int diskReadSectorsV (Disk* d, unsigned long addr, unsigned long numSectors,
+                      unsigned char** data) {
+	return __diskTransfer (d, addr, numSectors, data, 0);
+}
+
+//Funcao de escrita com agrupamento (gather): escreve numSectors setores
+//contiguos a partir do endereco LBA addr, sendo o k-esimo setor obtido de
+//data[k]. Retorna 0 se a escrita ocorreu sem erros e -1 caso contrario
+int diskWriteSectorsV (Disk* d, unsigned long addr, unsigned long numSectors,
+                       unsigned char** data) {
+	return __diskTransfer (d, addr, numSectors, data, 1);
+}
+
+//Funcao interna de comparacao de requisicoes por endereco
+int __diskCompareRequests (const void *a, const void *b) {
+	const DiskRequest *ra = a, *rb = b;
+	return (ra->addr > rb->addr) - (ra->addr < rb->addr);
+}
+
+//Funcao interna que escolhe, segundo a politica do disco, a proxima
+//requisicao a ser atendida dentre as ainda nao atendidas (served[k] == 0).
+//Para SSTF e C-LOOK a fila esta' ordenada por endereco
+unsigned long __diskPickRequest (Disk *d, char *served) {
+	unsigned long best = d->queueLen, bestDist = 0, cyl, dist;
+	for (unsigned long k = 0; k < d->queueLen; k++) {
+		if (served[k]) continue;
+		if (d->scheduler == DISK_SCHED_FIFO) return k;
+		diskAddrToCylinder (d, d->queue[k].addr, &cyl);
+		if (d->scheduler == DISK_SCHED_CLOOK) {
+			//Primeira requisicao adiante da cabeca; se nao houver,
+			//retorna ao menor endereco pendente
+			if (cyl >= d->currCylinder) return k;
+			if (best == d->queueLen) best = k;
+			continue;
+		}
+		dist = (cyl < d->currCylinder ? d->currCylinder - cyl
+		                              : cyl - d->currCylinder);
+		if (best == d->queueLen || dist < bestDist) {
+			best = k;
+			bestDist = dist;
+		}
+	}
+	return best;
+}
+
+//Funcao que define a politica de escalonamento das requisicoes enfileiradas
+//em um disco (DISK_SCHED_FIFO, DISK_SCHED_SSTF ou DISK_SCHED_CLOOK).
+//Retorna 0 se bem sucedida e -1 caso a politica seja invalida
+int diskSetScheduler (Disk* d, int policy) {
+	int ret = 0;
+	if (policy != DISK_SCHED_FIFO && policy != DISK_SCHED_SSTF
+	    && policy != DISK_SCHED_CLOOK)
 		return -1;
+	pthread_mutex_lock (&d->lock);
+	if (diskDispatch (d) < 0) ret = -1;
+	else d->scheduler = policy;
+	pthread_mutex_unlock (&d->lock);
+	return ret;
+}
+
+//Funcao que retorna a politica de escalonamento de um disco
+int diskGetScheduler (Disk* d) {
+	return d->scheduler;
+}
+
+//Funcao interna que insere uma requisicao de um setor na fila do disco. Se
+//status nao for NULL, *status recebe -1 caso a requisicao falhe. Deve ser
+//chamada com a exclusao mutua do disco obtida
+int __diskQueue (Disk *d, unsigned long addr, unsigned char *data, int write,
+                 int *status) {
+	if (addr >= d->numSectors) return -1;
+	//Apenas uma requisicao por setor e' mantida na fila, preservando a
+	//ordem entre leituras e escritas de um mesmo setor
+	for (unsigned long k = 0; k < d->queueLen; k++)
+		if (d->queue[k].addr == addr) {
+			//Escrita sobre escrita: a anterior e' substituida, mas
+			//seu resultado passa a acompanhar a nova
+			if (write && d->queue[k].write) {
+				DiskStatus *m = NULL;
+				if (d->queue[k].status) {
+					m = malloc (sizeof (DiskStatus));
+					if (!m) {
+						if (diskDispatch (d) < 0) return -1;
+						break;
+					}
+					m->status = d->queue[k].status;
+					m->next = d->queue[k].merged;
+					d->queue[k].merged = m;
+				}
+				d->queue[k].data = data;
+				d->queue[k].status = status;
+				return 0;
+			}
+			if (diskDispatch (d) < 0) return -1;
+			break;
+		}
+	if (d->queueLen == d->queueCap) {
+		unsigned long cap = (d->queueCap ? 2 * d->queueCap : 64);
+		DiskRequest *q = realloc (d->queue, cap * sizeof (DiskRequest));
+		if (!q) return -1;
+		d->queue = q;
+		d->queueCap = cap;
+	}
+	d->queue[d->queueLen].write = write;
+	d->queue[d->queueLen].addr = addr;
+	d->queue[d->queueLen].data = data;
+	d->queue[d->queueLen].status = status;
+	d->queue[d->queueLen].merged = NULL;
+	d->queueLen++;
 	return 0;
 }
 
+//Funcao que enfileira a leitura do setor addr para *data. A leitura so'
+//ocorre no despacho da fila (diskDispatch). Retorna 0 se enfileirada e -1
+//caso contrario
+int diskQueueRead (Disk* d, unsigned long addr, unsigned char* data) {
+	int ret;
+	pthread_mutex_lock (&d->lock);
+	ret = __diskQueue (d, addr, data, 0, NULL);
+	pthread_mutex_unlock (&d->lock);
+	return ret;
+}
+
+//Funcao que enfileira a escrita do setor addr a partir de *data, que deve
+//permanecer valido ate' o despacho da fila (diskDispatch). Retorna 0 se
+//enfileirada e -1 caso contrario
+int diskQueueWrite (Disk* d, unsigned long addr, unsigned char* data) {
+	int ret;
+	pthread_mutex_lock (&d->lock);
+	ret = __diskQueue (d, addr, data, 1, NULL);
+	pthread_mutex_unlock (&d->lock);
+	return ret;
+}
+
+//Funcao que atende todas as requisicoes enfileiradas em um disco, na ordem
+//determinada por sua politica de escalonamento. Requisicoes de mesmo tipo a
+//setores adjacentes sao agrupadas em uma unica transferencia. Retorna 0 se
+//todas foram atendidas sem erros e -1 caso contrario
+int diskDispatch (Disk* d) {
+	unsigned char **bufs = NULL;
+	char *served = NULL;
+	unsigned long done = 0;
+	int ret = 0;
+
+	pthread_mutex_lock (&d->lock);
+	if (d->queueLen == 0) goto out;
+	bufs = malloc (d->queueLen * sizeof (unsigned char*));
+	served = calloc (d->queueLen, sizeof (char));
+	if (!bufs || !served) {
+		ret = -1;
+		goto out;
+	}
+	if (d->scheduler != DISK_SCHED_FIFO)
+		qsort (d->queue, d->queueLen, sizeof (DiskRequest),
+		       __diskCompareRequests);
+
+	while (done < d->queueLen) {
+		unsigned long first = __diskPickRequest (d, served);
+		unsigned long last = first;
+		DiskRequest *r = &d->queue[first];
+		bufs[0] = r->data;
+		served[first] = 1;
+		while (last + 1 < d->queueLen && !served[last+1]
+		       && d->queue[last+1].write == r->write
+		       && d->queue[last+1].addr == d->queue[last].addr + 1) {
+			last++;
+			bufs[last-first] = d->queue[last].data;
+			served[last] = 1;
+		}
+		if (__diskDoTransfer (d, r->addr, last - first + 1, bufs,
+		                      r->write) < 0) {
+			ret = -1;
+			for (unsigned long k = first; k <= last; k++) {
+				if (d->queue[k].status)
+					*d->queue[k].status = -1;
+				for (DiskStatus *m = d->queue[k].merged; m;
+				     m = m->next)
+					*m->status = -1;
+			}
+		}
+		done += last - first + 1;
+	}
+	for (unsigned long k = 0; k < d->queueLen; k++)
+		while (d->queue[k].merged) {
+			DiskStatus *m = d->queue[k].merged;
+			d->queue[k].merged = m->next;
+			free (m);
+		}
+	d->queueLen = 0;
+out:
+	pthread_mutex_unlock (&d->lock);
+	free (bufs);
+	free (served);
+	return ret;
+}
+
+//Funcao que retorna o total de cilindros percorridos pelas cabecas de um
+//disco desde sua conexao
+unsigned long diskGetSeekDistance (Disk* d) {
+	unsigned long distance;
+	pthread_mutex_lock (&d->lock);
+	distance = d->seekDistance;
+	pthread_mutex_unlock (&d->lock);
+	return distance;
+}
+
+//Funcao interna que atende um lote de submissoes assincronas: todos os
+//setores do lote sao enfileirados e despachados juntos, de modo que o
+//escalonador os ordene e agrupe
+void __diskServeBatch (Disk *d, DiskIO *batch) {
+	pthread_mutex_lock (&d->lock);
+	for (DiskIO *io = batch; io; io = io->next) {
+		io->status = 0;
+		for (unsigned long k = 0; k < io->numSectors; k++)
+			if (__diskQueue (d, io->addr + k,
+			                 io->data + k * DISK_SECTORDATASIZE,
+			                 io->write, &io->status) < 0) {
+				io->status = -1;
+				break;
+			}
+	}
+	diskDispatch (d);
+	pthread_mutex_unlock (&d->lock);
+}
+
+//Funcao interna executada pela thread de cada disco. Aguarda submissoes,
+//atende-as em lotes e as entrega na fila de conclusoes ou por callback
+void* __diskWorker (void *arg) {
+	Disk *d = arg;
+	pthread_mutex_lock (&d->aioLock);
+	while (1) {
+		DiskIO *batch;
+		while (!d->submitHead && !d->workerStop)
+			pthread_cond_wait (&d->aioSubmitted, &d->aioLock);
+		if (!d->submitHead) break;
+		batch = d->submitHead;
+		d->submitHead = d->submitTail = NULL;
+		pthread_mutex_unlock (&d->aioLock);
+
+		__diskServeBatch (d, batch);
+
+		pthread_mutex_lock (&d->aioLock);
+		while (batch) {
+			DiskIO *io = batch;
+			batch = io->next;
+			io->next = NULL;
+			if (io->callback) {
+				pthread_mutex_unlock (&d->aioLock);
+				io->callback (io, io->arg);
+				pthread_mutex_lock (&d->aioLock);
+				d->inFlight--;
+				continue;
+			}
+			if (d->doneTail) d->doneTail->next = io;
+			else d->doneHead = io;
+			d->doneTail = io;
+		}
+		pthread_cond_broadcast (&d->aioCompleted);
+	}
+	pthread_mutex_unlock (&d->aioLock);
+	return NULL;
+}
+
+//Funcao que submete um lote de numIOs requisicoes de E/S assincrona a um
+//disco. As requisicoes sao atendidas pela thread do disco, criada no primeiro
+//uso, e seus buffers devem permanecer validos ate' a conclusao. Retorna 0 se
+//o lote foi submetido e -1 caso contrario
+int diskSubmit (Disk* d, DiskIO** ios, int numIOs) {
+	int ret = 0;
+	if (numIOs <= 0) return 0;
+	pthread_mutex_lock (&d->aioLock);
+	if (!d->workerRunning) {
+		if (pthread_create (&d->worker, NULL, __diskWorker, d) != 0)
+			ret = -1;
+		else d->workerRunning = 1;
+	}
+	if (ret == 0) {
+		for (int k = 0; k < numIOs; k++) {
+			ios[k]->status = 0;
+			ios[k]->next = NULL;
+			if (d->submitTail) d->submitTail->next = ios[k];
+			else d->submitHead = ios[k];
+			d->submitTail = ios[k];
+		}
+		d->inFlight += numIOs;
+		pthread_cond_signal (&d->aioSubmitted);
+	}
+	pthread_mutex_unlock (&d->aioLock);
+	return ret;
+}
+
+//Funcao interna que retira a primeira conclusao da fila. Deve ser chamada
+//com a exclusao mutua das filas assincronas obtida
+DiskIO* __diskPopCompletion (Disk *d) {
+	DiskIO *io = d->doneHead;
+	if (io) {
+		d->doneHead = io->next;
+		if (!d->doneHead) d->doneTail = NULL;
+		io->next = NULL;
+		d->inFlight--;
+	}
+	return io;
+}
+
+//Funcao que aguarda e retorna a proxima requisicao assincrona concluida
+//(sem callback). Retorna NULL se nao houver requisicoes pendentes
+DiskIO* diskWaitCompletion (Disk* d) {
+	DiskIO *io;
+	pthread_mutex_lock (&d->aioLock);
+	while (!d->doneHead && d->inFlight > 0)
+		pthread_cond_wait (&d->aioCompleted, &d->aioLock);
+	io = __diskPopCompletion (d);
+	pthread_mutex_unlock (&d->aioLock);
+	return io;
+}
+
+//Funcao que retorna, sem bloquear, a proxima requisicao assincrona concluida.
+//Retorna NULL se nenhuma estiver concluida
+DiskIO* diskPollCompletion (Disk* d) {
+	DiskIO *io;
+	pthread_mutex_lock (&d->aioLock);
+	io = __diskPopCompletion (d);
+	pthread_mutex_unlock (&d->aioLock);
+	return io;
+}
+
+//Funcao que liga (enable != 0) ou desliga o modo de relogio virtual de um
+//disco. Nesse modo o atraso de posicionamento das cabecas nao e' dormido,
+//sendo apenas somado ao relogio do disco
+void diskSetVirtualClock (Disk* d, int enable) {
+	d->virtualClock = (enable != 0);
+}
+
+//Funcao que retorna 1 se o disco opera com relogio virtual e 0 caso contrario
+int diskGetVirtualClock (Disk* d) {
+	return d->virtualClock;
+}
+
+//Funcao que retorna o tempo de disco acumulado desde a conexao, em ms,
+//segundo o modelo de atraso por cilindro percorrido
+unsigned long diskGetClock (Disk* d) {
+	unsigned long clock;
+	pthread_mutex_lock (&d->lock);
+	clock = d->clock;
+	pthread_mutex_unlock (&d->lock);
+	return clock;
+}
+
+//Funcao que retorna o instante atual do disco, em ms. No modo de relogio
+//virtual e' o proprio relogio do disco; caso contrario, um relogio monotonico
+//do sistema hospedeiro. Serve para medir intervalos entre operacoes
+unsigned long diskGetTime (Disk* d) {
+	unsigned long now;
+	pthread_mutex_lock (&d->lock);
+	if (d->virtualClock) now = d->clock;
+	else now = __diskNow () / 1000;
+	pthread_mutex_unlock (&d->lock);
+	return now;
+}
+
+//Funcao que retorna o tempo de disco, em ms, gasto pela ultima operacao
+unsigned long diskGetLastOpTime (Disk* d) {
+	unsigned long opTime;
+	pthread_mutex_lock (&d->lock);
+	opTime = d->lastOpTime;
+	pthread_mutex_unlock (&d->lock);
+	return opTime;
+}
+
+//Funcao que copia para *stats os contadores de E/S de um disco
+void diskGetStats (Disk* d, DiskStats *stats) {
+	pthread_mutex_lock (&d->lock);
+	*stats = d->stats;
+	pthread_mutex_unlock (&d->lock);
+}
+
+//Funcao que zera os contadores de E/S de um disco
+void diskResetStats (Disk* d) {
+	pthread_mutex_lock (&d->lock);
+	memset (&d->stats, 0, sizeof (DiskStats));
+	pthread_mutex_unlock (&d->lock);
+}
+
+//Funcao que escreve na saida padrao os contadores de E/S e os histogramas de
+//latencia de um disco
+void diskDumpStats (Disk* d) {
+	const char *opNames[] = { "Read", "Write" };
+	DiskStats st;
+	diskGetStats (d, &st);
+	printf ("-- DiskStats: DiskID: %d; Seeks: %lu; Cylinders: %lu\n",
+	        d->id, st.seeks, st.cylinders);
+	for (int op = DISK_OP_READ; op <= DISK_OP_WRITE; op++) {
+		unsigned long max = 0;
+		printf ("-- %s: Ops: %lu; Sectors: %lu; Bytes: %lu; "
+		        "AvgLatency: %lu us\n", opNames[op], st.ops[op],
+		        st.sectors[op], st.bytes[op],
+		        st.ops[op] ? st.latencyTotal[op] / st.ops[op] : 0);
+		for (int b = 0; b < DISK_LATENCY_BUCKETS; b++)
+			if (st.latency[op][b] > max) max = st.latency[op][b];
+		for (int b = 0; b < DISK_LATENCY_BUCKETS; b++) {
+			unsigned long n = st.latency[op][b];
+			if (!n) continue;
+			printf ("   %10lu us <= lat < %10lu us: %8lu ",
+			        b ? 1UL << (b - 1) : 0UL, 1UL << b, n);
+			for (unsigned long k = 0; k < (n * 40 + max - 1) / max; k++)
+				printf ("#");
+			printf ("\n");
+		}
+	}
+}
+
 //Funcao para a criacao de um disco fisico, a ser representado pelo arquivo
 //regular indicado por rawDiskPath e com numero total de cilindros indicado
 //por numCylinders. Retorna 0 se o disco fisico for criado com sucesso e -1
-//caso contrario. O disco fisico ja eh criado com formatacao de baixo nivel
+//caso contrario. O disco fisico ja eh criado com formatacao de baixo nivel.
+//As trilhas sao pre-formatadas uma unica vez em memoria e gravadas em blocos
+//de DISK_CREATECHUNKTRACKS trilhas
 int diskCreateRawDisk (char* rawDiskPath, unsigned long numCylinders) {
 	FILE* fp;
+	unsigned char *chunk;
+	unsigned long trackSize = DISK_SECTORSPERTRACK * DISK_SECTORTOTALSIZE;
+	int ret = 0;
 	if (numCylinders == 0) return -1;
+	chunk = malloc (DISK_CREATECHUNKTRACKS * trackSize);
+	if (chunk == NULL) return -1;
+	for (unsigned long j = 0;
+	     j < DISK_CREATECHUNKTRACKS * DISK_SECTORSPERTRACK; j++) {
+		unsigned char *sector = chunk + j * DISK_SECTORTOTALSIZE;
+		memcpy (sector, DISK_SECTORPREAMBLE, DISK_SECTORDATAOFFSET);
+		memset (sector + DISK_SECTORDATAOFFSET, ' ', DISK_SECTORDATASIZE);
+		memcpy (sector + DISK_SECTORDATAOFFSET + DISK_SECTORDATASIZE,
+		        DISK_SECTORECC, DISK_SECTORDATAOFFSET);
+	}
 	fp = fopen (rawDiskPath, "w+");
-	if (fp == NULL) return -1;
-	for (unsigned long i = 0; i < numCylinders; i++) {
-		for (int j = 0; j < DISK_SECTORSPERTRACK; j++) {
-			fwrite(DISK_SECTORPREAMBLE,1,DISK_SECTORDATAOFFSET,fp);
-			for (int k = 0; k < DISK_SECTORDATASIZE; k++)
-				fwrite(" ",1,1,fp);
-			fwrite(DISK_SECTORECC,1,DISK_SECTORDATAOFFSET,fp);
-		}
-//		fflush(stdout);
+	if (fp == NULL) {
+		free (chunk);
+		return -1;
 	}
-	fclose(fp);
-	return 0;
+	for (unsigned long i = 0; i < numCylinders && ret == 0;
+	     i += DISK_CREATECHUNKTRACKS) {
+		unsigned long tracks = numCylinders - i;
+		if (tracks > DISK_CREATECHUNKTRACKS)
+			tracks = DISK_CREATECHUNKTRACKS;
+		if (fwrite (chunk, trackSize, tracks, fp) != tracks) ret = -1;
+	}
+	if (fclose (fp) != 0) ret = -1;
+	free (chunk);
+	return ret;
+}
+
+//Funcao para a criacao de um disco fisico com ao menos sizeBytes bytes de
+//espaco util para dados. O numero de cilindros e' arredondado para cima.
+//Retorna 0 se o disco fisico for criado com sucesso e -1 caso contrario
+int diskCreateRawDiskSize (char* rawDiskPath, unsigned long sizeBytes) {
+	unsigned long cylSize = DISK_SECTORSPERTRACK * DISK_SECTORDATASIZE;
+	return diskCreateRawDisk (rawDiskPath,
+	                          sizeBytes / cylSize
+	                          + (sizeBytes % cylSize ? 1 : 0));
 }
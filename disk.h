@@ -32,9 +32,57 @@
 //Tamanho padrao do setor de qualquer disco, em bytes
 #define DISK_SECTORDATASIZE 512
 
+//Implementacoes de E/S sobre o arquivo que representa o disco fisico
+#define DISK_BACKEND_STDIO 0	//fseek + fread/fwrite por transferencia
+#define DISK_BACKEND_MMAP 1	//Arquivo mapeado em memoria (mmap)
+
+//Politicas de escalonamento das requisicoes enfileiradas em um disco
+#define DISK_SCHED_FIFO 0	//Ordem de chegada
+#define DISK_SCHED_SSTF 1	//Menor deslocamento a partir do cilindro atual
+#define DISK_SCHED_CLOOK 2	//Elevador circular (C-LOOK), padrao
+
+//Tipos de operacao contabilizados nas estatisticas de um disco
+#define DISK_OP_READ 0
+#define DISK_OP_WRITE 1
+
+//Numero de faixas dos histogramas de latencia, em escala logaritmica: a faixa
+//k (k > 0) conta operacoes com latencia em [2^(k-1), 2^k) microssegundos, a
+//faixa 0 as de menos de 1 us e a ultima tambem as acima de seu limite
+#define DISK_LATENCY_BUCKETS 32
+
 //Tipo de dados para a representacao de discos fisicos
 typedef struct disk Disk;
 
+//Contadores de E/S de um disco, acumulados desde a conexao ou desde o ultimo
+//diskResetStats. Sao indexados por DISK_OP_READ e DISK_OP_WRITE onde cabivel
+typedef struct disk_stats {
+	unsigned long ops[2];		//Transferencias realizadas
+	unsigned long sectors[2];	//Setores transferidos
+	unsigned long bytes[2];		//Bytes movidos no arquivo do disco,
+					//incluindo preambulo e ECC entre setores
+	unsigned long seeks;		//Transferencias que moveram as cabecas
+	unsigned long cylinders;	//Cilindros percorridos pelas cabecas
+	unsigned long latencyTotal[2];	//Soma das latencias, em us
+	unsigned long latency[2][DISK_LATENCY_BUCKETS]; //Histogramas
+} DiskStats;
+
+//Requisicao de E/S assincrona sobre numSectors setores contiguos a partir do
+//endereco LBA addr. Os dados sao lidos para (ou escritos a partir de) data,
+//que deve comportar numSectors * DISK_SECTORDATASIZE bytes e permanecer
+//valido ate' a conclusao. Se callback nao for NULL, e' chamada na conclusao
+//pela thread do disco; caso contrario, a requisicao concluida e' entregue por
+//diskWaitCompletion ou diskPollCompletion
+typedef struct disk_io {
+	int write;			//1 para escrita, 0 para leitura
+	unsigned long addr;		//Endereco LBA do primeiro setor
+	unsigned long numSectors;	//Numero de setores contiguos
+	unsigned char *data;		//Buffer de dados
+	int status;			//Resultado: 0 se bem sucedida, -1 em erro
+	void (*callback) (struct disk_io *io, void *arg);
+	void *arg;			//Argumento repassado a callback
+	struct disk_io *next;		//Uso interno do disco
+} DiskIO;
+
 //Funcao que conecta um disco fisico ao sistema operacional.
 //Um disco fisico eh implementado por meio de um arquivo regular, 
 //cujo caminho eh dado por rawDiskPath.
@@ -43,9 +91,19 @@ typedef struct disk Disk;
 //Caso contrario, retorna NULL
 Disk* diskConnect(int id, char* diskFilePath);
 
+//Funcao que conecta um disco fisico ao sistema operacional, tal como
+//diskConnect, escolhendo a implementacao de E/S sobre o arquivo do disco
+//(DISK_BACKEND_STDIO ou DISK_BACKEND_MMAP). Em sistemas sem mmap, o disco e'
+//conectado com DISK_BACKEND_STDIO. Retorna NULL se o disco nao existir ou se
+//nao puder ser mapeado em memoria
+Disk* diskConnectBackend(int id, char* diskFilePath, int backend);
+
 //Funcao que disconecta um disco fisico do sistema operacional
 int diskDisconnect(Disk* d);
 
+//Funcao que retorna a implementacao de E/S (DISK_BACKEND_*) usada por um disco
+int diskGetBackend (Disk* d);
+
 //Funcao que retorna o identificador de um disco fisico, conforme atribuido
 //pelo sistema operacional no momento da conexao
 int diskGetId (Disk* d);
@@ -79,10 +137,119 @@ int diskReadSector (Disk* d, unsigned long addr, unsigned char* data);
 //ocorreu sem erros e -1 caso contrario
 int diskWriteSector (Disk* d, unsigned long int addr, unsigned char* data);
 
+//Funcao para realizar a leitura de numSectors setores contiguos a partir do
+//endereco LBA addr, com um unico posicionamento da cabeca e uma unica operacao
+//de E/S no arquivo do disco. Os dados sao transferidos, em sequencia, para
+//*data, que deve comportar numSectors * DISK_SECTORDATASIZE bytes. Retorna 0
+//se a leitura ocorreu sem erros e -1 caso contrario
+int diskReadSectors (Disk* d, unsigned long addr, unsigned long numSectors,
+                     unsigned char* data);
+
+//Funcao para realizar a escrita de numSectors setores contiguos a partir do
+//endereco LBA addr, com um unico posicionamento da cabeca e uma unica operacao
+//de E/S no arquivo do disco. Os dados sao transferidos, em sequencia, a partir
+//de *data. Retorna 0 se a escrita ocorreu sem erros e -1 caso contrario
+int diskWriteSectors (Disk* d, unsigned long addr, unsigned long numSectors,
+                      unsigned char* data);
+
+//Funcao de leitura com dispersao (scatter): le numSectors setores contiguos
+//a partir do endereco LBA addr, copiando o k-esimo setor para data[k]. Cada
+//data[k] deve comportar DISK_SECTORDATASIZE bytes. Retorna 0 se a leitura
+//ocorreu sem erros e -1 caso contrario
+int diskReadSectorsV (Disk* d, unsigned long addr, unsigned long numSectors,
+                      unsigned char** data);
+
+//Funcao de escrita com agrupamento (gather): escreve numSectors setores
+//contiguos a partir do endereco LBA addr, sendo o k-esimo setor obtido de
+//data[k]. Retorna 0 se a escrita ocorreu sem erros e -1 caso contrario
+int diskWriteSectorsV (Disk* d, unsigned long addr, unsigned long numSectors,
+                       unsigned char** data);
+
+//Funcao que define a politica de escalonamento das requisicoes enfileiradas
+//em um disco (DISK_SCHED_FIFO, DISK_SCHED_SSTF ou DISK_SCHED_CLOOK). As
+//requisicoes pendentes sao despachadas antes da troca. Retorna 0 se bem
+//sucedida e -1 caso contrario
+int diskSetScheduler (Disk* d, int policy);
+
+//Funcao que retorna a politica de escalonamento de um disco
+int diskGetScheduler (Disk* d);
+
+//Funcao que enfileira a leitura do setor addr para *data. A leitura so'
+//ocorre no despacho da fila (diskDispatch). Retorna 0 se enfileirada e -1
+//caso contrario
+int diskQueueRead (Disk* d, unsigned long addr, unsigned char* data);
+
+//Funcao que enfileira a escrita do setor addr a partir de *data, que deve
+//permanecer valido ate' o despacho da fila (diskDispatch). Retorna 0 se
+//enfileirada e -1 caso contrario
+int diskQueueWrite (Disk* d, unsigned long addr, unsigned char* data);
+
+//Funcao que atende todas as requisicoes enfileiradas em um disco, na ordem
+//determinada por sua politica de escalonamento. Requisicoes de mesmo tipo a
+//setores adjacentes sao agrupadas em uma unica transferencia. Retorna 0 se
+//todas foram atendidas sem erros e -1 caso contrario
+int diskDispatch (Disk* d);
+
+//Funcao que retorna o total de cilindros percorridos pelas cabecas de um
+//disco desde sua conexao
+unsigned long diskGetSeekDistance (Disk* d);
+
+//Funcao que submete um lote de numIOs requisicoes de E/S assincrona a um
+//disco. As requisicoes sao atendidas pela thread do disco, criada no primeiro
+//uso, que as enfileira e despacha juntas segundo a politica de escalonamento.
+//Retorna 0 se o lote foi submetido e -1 caso contrario
+int diskSubmit (Disk* d, DiskIO** ios, int numIOs);
+
+//Funcao que aguarda e retorna a proxima requisicao assincrona concluida
+//(sem callback). Retorna NULL se nao houver requisicoes pendentes
+DiskIO* diskWaitCompletion (Disk* d);
+
+//Funcao que retorna, sem bloquear, a proxima requisicao assincrona concluida.
+//Retorna NULL se nenhuma estiver concluida
+DiskIO* diskPollCompletion (Disk* d);
+
+//Funcao que liga (enable != 0) ou desliga o modo de relogio virtual de um
+//disco. Nesse modo o atraso de posicionamento das cabecas nao e' dormido,
+//sendo apenas somado ao relogio do disco
+void diskSetVirtualClock (Disk* d, int enable);
+
+//Funcao que retorna 1 se o disco opera com relogio virtual e 0 caso contrario
+int diskGetVirtualClock (Disk* d);
+
+//Funcao que retorna o tempo de disco acumulado desde a conexao, em ms,
+//segundo o modelo de atraso por cilindro percorrido. O relogio avanca tanto
+//no modo real quanto no modo virtual
+unsigned long diskGetClock (Disk* d);
+
+//Funcao que retorna o instante atual do disco, em ms: o relogio do disco no
+//modo de relogio virtual ou um relogio monotonico do hospedeiro nos demais
+//casos. Apenas diferencas entre dois valores tem significado
+unsigned long diskGetTime (Disk* d);
+
+//Funcao que retorna o tempo de disco, em ms, gasto pela ultima operacao
+unsigned long diskGetLastOpTime (Disk* d);
+
+//Funcao que copia para *stats os contadores de E/S de um disco. A latencia de
+//cada transferencia inclui o posicionamento das cabecas, mesmo quando apenas
+//simulado pelo relogio virtual
+void diskGetStats (Disk* d, DiskStats *stats);
+
+//Funcao que zera os contadores de E/S de um disco
+void diskResetStats (Disk* d);
+
+//Funcao que escreve na saida padrao os contadores de E/S e os histogramas de
+//latencia de um disco
+void diskDumpStats (Disk* d);
+
 //Funcao para a criacao de um disco fisico, a ser representado pelo arquivo
 //regular indicado por rawDiskPath e com numero total de cilindros indicado
 //por numCylinders. Retorna 0 se o disco fisico for criado com sucesso e -1
 //caso contrario. O disco fisico ja eh criado com formatacao de baixo nivel
 int diskCreateRawDisk (char* rawDiskPath, unsigned long numCylinders);
 
+//Funcao para a criacao de um disco fisico com ao menos sizeBytes bytes de
+//espaco util para dados. O numero de cilindros e' arredondado para cima.
+//Retorna 0 se o disco fisico for criado com sucesso e -1 caso contrario
+int diskCreateRawDiskSize (char* rawDiskPath, unsigned long sizeBytes);
+
 #endif
@@ -11,7 +11,10 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "inode.h"
+#include "cache.h"
 #include "util.h"
 
 #define INODE_BEGINSECTOR 2     //Setor a partir do qual i-nodes são gravados
@@ -19,7 +22,8 @@
 #define NUMBLOCKS_PERINODE 8	//No. de enderecos de bloco por i-node
 				
 #define NUMITEMS_PERINODE (INODE_SIZE - 2)	//Numero de "itens" por i-node
-#define INODE_ITEM_BLOCKADDR 0		//Itens 0 a 7: Enderecos de bloco
+#define INODE_SECTORWORDS (DISK_SECTORDATASIZE / UTIL_WORDSIZE) //Valores/setor
+#define INODE_ITEM_BLOCKADDR 0		//Itens 0 a 7: Raiz da arvore de extents
 #define INODE_ITEM_FILETYPE (INODE_SIZE - 8)	//Item 8: Tipo de arquivo
 #define INODE_ITEM_FILESIZE (INODE_SIZE - 7)	//Item 9: Tamanho do arquivo
 #define INODE_ITEM_OWNER (INODE_SIZE - 6)	//Item 10: Proprietario
@@ -27,34 +31,572 @@
 #define INODE_ITEM_PERMISSION (INODE_SIZE - 4)	//Item 12: Permissao
 #define INODE_ITEM_REFCOUNT (INODE_SIZE - 3)	//Item 13: Contador referencia
 
-//Tipo para representacao de i-nodes
+#define INODE_CACHESIZE 64	//I-nodes sem referencias mantidos em memoria
+#define INODE_HASHSIZE 127	//Numero de listas da tabela hash da cache
+#define INODE_MAXDISKS 16	//Discos com tamanho de bloco ou mapa informados
+#define INODE_MAXREGIONS 64	//Regioes da tabela de i-nodes por disco
+#define INODE_INITSECTORS 64	//Setores por escrita ao iniciar a tabela
+#define INODE_MAPWORDBITS 64	//Bits por palavra do mapa de i-nodes livres
+#define INODE_MAPSECTORBITS (DISK_SECTORDATASIZE * 8) //Bits por setor do mapa
+
+//Mapeamento de blocos por extents: cada extent descreve uma sequencia de
+//blocos logicos contiguos do arquivo gravada em blocos fisicamente contiguos.
+//Os extents formam uma arvore ordenada pelo bloco logico. A raiz ocupa os
+//itens de enderecos de bloco do i-node do arquivo e os demais nos ocupam
+//blocos de dados inteiros, obtidos do sistema de arquivos (ver
+//inodeSetAllocator). O primeiro item de cada no' e' o cabecalho (EXTENT_NODE
+//se gravado em bloco, profundidade e numero de entradas). Folhas
+//(profundidade 0) guardam extents {bloco logico, endereco fisico, numero de
+//blocos}; nos internos guardam {bloco logico, endereco do bloco filho}
+#define EXTENT_NODE 0x80000000		//Cabecalho de no' gravado em bloco
+#define EXTENT_DEPTHSHIFT 16		//Posicao da profundidade no cabecalho
+#define EXTENT_COUNTMASK 0xFFFF		//Numero de entradas no cabecalho
+#define EXTENT_LEAFITEMS 3		//Itens por extent
+#define EXTENT_INDEXITEMS 2		//Itens por entrada de no' interno
+#define EXTENT_MAXDEPTH 16		//Profundidade maxima da arvore
+
+//Tipo para representacao de i-nodes. Cada i-node de um disco tem uma unica
+//copia em memoria, compartilhada por todos que o carregam
 struct inode {
 	unsigned int inodeItem[NUMITEMS_PERINODE]; //Blocos e dados do i-node
 	unsigned int number; 	//Numero do i-node
-	unsigned int next;	//Numero do proximo i-node em caso de extensao
 	Disk *d; 		//Disco ao qual pertence o i-node
+	unsigned int refs;	//Referencias obtidas e ainda nao liberadas
+	int dirty;		//Alterado desde a ultima gravacao em seu setor
+	unsigned int *tail;	//Copia da folha mais a direita da arvore (ou NULL)
+	unsigned int tailAddr;	//Bloco da folha mais a direita
+	struct inode *hashNext;	//Proximo i-node na mesma lista da tabela hash
+	struct inode *lruPrev;	//I-node sem referencias usado mais recentemente
+	struct inode *lruNext;	//I-node sem referencias usado ha mais tempo
 };
 
-//Funcao interna que retorna a ultima extensao de um i-node. Retorna NULL
-//se nao houver extensoes do i-node fornecido.
-Inode* __inodeGetLastExtension (Inode *i) {
-	unsigned int niNumber = 0;
-	Disk *d = i->d;
-	if (i->next) {
-		niNumber = i->next;
-		i = inodeLoad (niNumber, d);
-		if (!i) return NULL;
-	} 
-	else return NULL;
-	while (i->next != 0) {
-		niNumber = i->next;
+static Inode *hashTable[INODE_HASHSIZE];
+
+//Informacoes de cada disco sobre sua area de i-nodes: tamanho de bloco (ver
+//inodeSetBlockSize), obtencao de blocos (ver inodeSetAllocator) e mapa de
+//i-nodes em uso (ver inodeLoadBitmap). A tabela de i-nodes e' formada por
+//regioes de setores contiguos (ver inodeAddRegion), numeradas em sequencia.
+//O bit n do mapa corresponde ao i-node n; bits sem i-node correspondente ficam
+//em uso. Os setores da tabela apos os primeiros initInodes i-nodes nunca foram
+//gravados: seus i-nodes sao vazios e os setores so' sao iniciados quando um
+//deles e' criado ou salvo
+typedef struct inode_region {
+	unsigned long start;		//Primeiro setor da regiao
+	unsigned int first;		//Numero do primeiro i-node da regiao
+	unsigned int count;		//Numero de i-nodes da regiao
+} InodeRegion;
+
+typedef struct inode_area {
+	Disk *d;
+	unsigned int blockSectors;	//Setores por bloco
+	unsigned int (*allocFn)(Disk *d, unsigned int goal); //Obtencao de bloco
+	int (*freeFn)(Disk *d, unsigned int blockAddr); //Liberacao de bloco
+	InodeRegion regions[INODE_MAXREGIONS];	//Regioes da tabela
+	unsigned int numRegions;	//Numero de regioes da tabela
+	unsigned int numInodes;		//Numero de i-nodes nas regioes
+	unsigned int maxInodes;		//Capacidade do mapa de i-nodes
+	unsigned int initInodes;	//I-nodes ja' iniciados em disco
+	unsigned long bitmapSector;	//Primeiro setor do mapa em disco
+	unsigned long long *bitmap;	//Mapa de i-nodes em uso, por palavras
+	unsigned int numWords;		//Numero de palavras do mapa
+	unsigned int hint;		//Primeira palavra que pode ter bit livre
+	int dirty;			//Mapa alterado desde a ultima gravacao
+} InodeArea;
+
+static InodeArea areas[INODE_MAXDISKS];
+static Inode *lruHead = NULL;	//Sem referencias, usado mais recentemente
+static Inode *lruTail = NULL;	//Sem referencias, usado ha mais tempo
+static unsigned int lruLen = 0;	//Numero de i-nodes sem referencias
+
+//Exclusao mutua (recursiva) sobre a cache de i-nodes e as areas de i-nodes,
+//compartilhadas por todos os discos. O conteudo de cada i-node e' protegido
+//pelo sistema de arquivos que o obteve
+static pthread_mutex_t inodeLock;
+static pthread_once_t inodeLockOnce = PTHREAD_ONCE_INIT;
+
+//Funcao interna que inicia a exclusao mutua sobre os i-nodes
+static void __inodeLockInit (void) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init (&attr);
+	pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init (&inodeLock, &attr);
+	pthread_mutexattr_destroy (&attr);
+}
+
+//Funcao interna que obtem a exclusao mutua sobre os i-nodes
+static void __inodeLock (void) {
+	pthread_once (&inodeLockOnce, __inodeLockInit);
+	pthread_mutex_lock (&inodeLock);
+}
+
+//Funcao interna que libera a exclusao mutua sobre os i-nodes
+static void __inodeUnlock (void) {
+	pthread_mutex_unlock (&inodeLock);
+}
+
+//Funcao interna que calcula a lista da tabela hash de um i-node
+static unsigned int __inodeHash (Disk *d, unsigned int number) {
+	return (unsigned int) (((unsigned long) d >> 4) ^ number)
+	       % INODE_HASHSIZE;
+}
+
+//Funcao interna que procura um i-node na cache. Retorna NULL se ausente
+static Inode* __inodeLookup (Disk *d, unsigned int number) {
+	Inode *i = hashTable[__inodeHash (d, number)];
+	while (i && (i->d != d || i->number != number)) i = i->hashNext;
+	return i;
+}
+
+//Funcao interna que retira um i-node da tabela hash
+static void __inodeUnhash (Inode *i) {
+	Inode **p = &hashTable[__inodeHash (i->d, i->number)];
+	while (*p != i) p = &(*p)->hashNext;
+	*p = i->hashNext;
+}
+
+//Funcao interna que retira um i-node da lista LRU de i-nodes sem referencias
+static void __inodeUnlinkLRU (Inode *i) {
+	if (i->lruPrev) i->lruPrev->lruNext = i->lruNext;
+	else lruHead = i->lruNext;
+	if (i->lruNext) i->lruNext->lruPrev = i->lruPrev;
+	else lruTail = i->lruPrev;
+	i->lruPrev = i->lruNext = NULL;
+	lruLen--;
+}
+
+//Funcao interna que retorna o numero de setores de um bloco do disco d. Sem
+//tamanho de bloco informado, cada bloco e' tratado como um setor
+static unsigned int __inodeBlockSectors (Disk *d) {
+	for (int k = 0; k < INODE_MAXDISKS; k++)
+		if (areas[k].d == d && areas[k].blockSectors)
+			return areas[k].blockSectors;
+	return 1;
+}
+
+//Funcao interna que retorna as informacoes da area de i-nodes de um disco.
+//Se ausentes e create for verdadeiro, uma entrada vazia e' reservada para o
+//disco. Retorna NULL se ausentes ou se nao houver entrada disponivel
+static InodeArea* __inodeArea (Disk *d, int create) {
+	InodeArea *freeArea = NULL;
+	for (int k = 0; k < INODE_MAXDISKS; k++) {
+		if (areas[k].d == d) return &areas[k];
+		if (!freeArea && !areas[k].d) freeArea = &areas[k];
+	}
+	if (!create || !freeArea) return NULL;
+	memset (freeArea, 0, sizeof(InodeArea));
+	freeArea->d = d;
+	return freeArea;
+}
+
+//Funcao interna que retorna a regiao da tabela de i-nodes de uma area que
+//contem o i-node number, ou NULL se a area nao possuir regioes
+static InodeRegion* __inodeRegion (InodeArea *a, unsigned int number) {
+	int lo = 0, hi, found = 0;
+	if (!a || !a->numRegions) return NULL;
+	hi = (int) a->numRegions - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (a->regions[mid].first <= number) {
+			found = mid;
+			lo = mid + 1;
+		}
+		else hi = mid - 1;
+	}
+	return &a->regions[found];
+}
+
+//Funcao interna que retorna o endereco do setor onde se encontra o i-node
+//number de um disco. Sem regioes informadas, a tabela se inicia no setor
+//INODE_BEGINSECTOR
+static unsigned long int __inodeSector (Disk *d, unsigned int number) {
+	unsigned int perSector = DISK_SECTORDATASIZE
+	                         / (INODE_SIZE * sizeof(unsigned int));
+	InodeRegion *r = __inodeRegion (__inodeArea (d, 0), number);
+	if (r) return r->start + (number - r->first) / perSector;
+	return INODE_BEGINSECTOR + (number - 1) / perSector;
+}
+
+//Funcao interna que retorna a posicao de inicio do i-node number dentro de
+//seu setor
+static unsigned long int __inodeOffset (unsigned int number) {
+	unsigned long int sizeUInt = sizeof(unsigned int);
+	return ((number - 1) % (DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
+	       * INODE_SIZE * sizeUInt;
+}
+
+//Funcao interna que codifica os itens (items) e o numero de um i-node em sua
+//posicao no setor. A ultima palavra, que encadeava i-nodes de extensao antes
+//da arvore de extents, e' reservada e gravada como 0
+static void __inodeEncode (unsigned int *items, unsigned int number,
+                           unsigned char *sector) {
+	unsigned int words[INODE_SIZE];
+	memcpy (words, items, NUMITEMS_PERINODE * sizeof(unsigned int));
+	words[INODE_SIZE-2] = number;
+	words[INODE_SIZE-1] = 0;
+	ul2charArray (words, INODE_SIZE, &sector[__inodeOffset (number)]);
+}
+
+//Funcao interna que decodifica de uma so' vez todos os i-nodes de um setor
+//(sector) para words, INODE_SIZE valores por i-node
+static void __inodeDecodeSector (unsigned char *sector, unsigned int *words) {
+	char2ulArray (sector, INODE_SECTORWORDS, words);
+}
+
+//Funcao interna que inicia em disco os setores da tabela de i-nodes ainda nao
+//iniciados, ate' o setor do i-node number, por meio da cache de setores. Os
+//setores sao montados em memoria, sem leitura, e gravados em lotes de ate'
+//INODE_INITSECTORS setores. Retorna 0 se bem sucedida e -1 caso contrario
+static int __inodeInitUpTo (Disk *d, unsigned int number) {
+	InodeArea *a = __inodeArea (d, 0);
+	unsigned int perSector = DISK_SECTORDATASIZE
+	                         / (INODE_SIZE * sizeof(unsigned int));
+	unsigned int items[NUMITEMS_PERINODE] = {0};
+	unsigned int last;
+	unsigned char *buffer;
+	if (!a || !a->bitmap || number <= a->initInodes) return 0;
+	last = (number + perSector - 1) / perSector * perSector;
+	if (last > a->numInodes) last = a->numInodes;
+	buffer = malloc (INODE_INITSECTORS * DISK_SECTORDATASIZE);
+	if (!buffer) return -1;
+	while (a->initInodes < last) {
+		unsigned int first = a->initInodes + 1;
+		InodeRegion *r = __inodeRegion (a, first);
+		//Cada lote se limita a uma regiao, de setores contiguos
+		unsigned int end = (r ? r->first + r->count - 1 : last);
+		unsigned int count;
+		if (end > last) end = last;
+		count = (end - first) / perSector + 1;
+		if (count > INODE_INITSECTORS) {
+			count = INODE_INITSECTORS;
+			end = first - 1 + count * perSector;
+		}
+		memset (buffer, 0, count * DISK_SECTORDATASIZE);
+		for (unsigned int n = first; n <= end; n++)
+			__inodeEncode (items, n, buffer
+			               + (__inodeSector (d, n)
+			                  - __inodeSector (d, first))
+			               * DISK_SECTORDATASIZE);
+		if (cacheWriteSectors (d, __inodeSector (d, first), count,
+		                       buffer) < 0) {
+			free (buffer);
+			return -1;
+		}
+		a->initInodes = end;
+		//O mapa em disco passa a cobrir os i-nodes iniciados
+		a->dirty = 1;
+	}
+	free (buffer);
+	return 0;
+}
+
+//Funcao interna que grava o setor de um i-node, por meio da cache de setores,
+//junto com os i-nodes alterados do mesmo setor mantidos na cache de i-nodes.
+//Assim, o setor e' lido e gravado uma unica vez para todos eles. I-nodes com
+//referencias so' sao incluidos se o disco for owner, cujo sistema de arquivos
+//requisitou a gravacao: os de outros discos podem estar sendo alterados.
+//Retorna 0 se bem sucedida e -1 caso contrario
+static int __inodeWriteBack (Inode *i, Disk *owner) {
+	unsigned int perSector = DISK_SECTORDATASIZE
+	                         / (INODE_SIZE * sizeof(unsigned int));
+	unsigned long int inodeSectorAddr = __inodeSector (i->d, i->number);
+	unsigned int first = i->number - __inodeOffset (i->number)
+	                     / (INODE_SIZE * sizeof(unsigned int));
+	unsigned char sector[DISK_SECTORDATASIZE];
+	Inode *dirty[DISK_SECTORDATASIZE / (INODE_SIZE * sizeof(unsigned int))];
+	unsigned int numDirty = 0;
+
+	int ret = __inodeInitUpTo (i->d, i->number);
+	if (ret < 0) return ret;
+	ret = cacheReadSector (i->d, inodeSectorAddr, sector);
+	if (ret < 0) return ret;
+
+	//Alterando no setor todos os i-nodes alterados que nele se encontram
+	for (unsigned int n = first; n < first + perSector; n++) {
+		Inode *si = __inodeLookup (i->d, n);
+		if (!si || (si->refs > 0 && si != i && si->d != owner)
+		    || !si->dirty)
+			continue;
+		__inodeEncode (si->inodeItem, si->number, sector);
+		dirty[numDirty++] = si;
+	}
+
+	//Salvando todo o setor onde se encontram os i-nodes...
+	ret = cacheWriteSector (i->d, inodeSectorAddr, sector);
+	if (ret == 0)
+		for (unsigned int k = 0; k < numDirty; k++)
+			dirty[k]->dirty = 0;
+	return ret;
+}
+
+//Funcao interna que le um i-node de seu setor, por meio da cache de setores.
+//Retorna 0 se bem sucedida e -1 caso contrario
+static int __inodeReadIn (Inode *i) {
+	//Endereco do setor do qual o i-node sera' lido
+	unsigned long int inodeSectorAddr = __inodeSector (i->d, i->number);
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int words[INODE_SECTORWORDS];
+	InodeArea *a = __inodeArea (i->d, 0);
+
+	//I-node em setor ainda nao iniciado: vazio, sem leitura
+	if (a && a->bitmap && i->number > a->initInodes) return 0;
+
+	int ret = cacheReadSector (i->d, inodeSectorAddr, sector);
+	if (ret < 0) return ret;
+
+	//Posicao de inicio do i-node entre os valores do setor
+	unsigned int *w = words + __inodeOffset (i->number) / UTIL_WORDSIZE;
+
+	//Recuperando enderecos de blocos e atributos do i-node no setor
+	__inodeDecodeSector (sector, words);
+	memcpy (i->inodeItem, w, NUMITEMS_PERINODE * sizeof(unsigned int));
+	i->number = w[INODE_SIZE-2];
+	return 0;
+}
+
+//Funcao interna que descarta da cache os i-nodes sem referencias usados ha
+//mais tempo, ate' que caibam em INODE_CACHESIZE. I-nodes alterados sao
+//gravados antes do descarte. O descarte e' requisitado pelo sistema de
+//arquivos do disco owner
+static void __inodeTrim (Disk *owner) {
+	while (lruLen > INODE_CACHESIZE) {
+		Inode *i = lruTail;
+		if (i->dirty && __inodeWriteBack (i, owner) < 0) break;
+		__inodeUnlinkLRU (i);
+		__inodeUnhash (i);
+		free (i->tail);
 		free (i);
-		i = inodeLoad (niNumber, d);
-		if (!i) return NULL;
 	}
+}
+
+//Funcao interna que obtem uma referencia ao i-node number de um disco,
+//mantido na cache. Se ausente, o i-node e' lido de seu setor (load != 0) ou
+//iniciado vazio (load = 0). Retorna NULL em caso de falha
+static Inode* __inodeGet (unsigned int number, Disk *d, int load) {
+	Inode *i;
+	if (number < 1 || !d) return NULL;
+	i = __inodeLookup (d, number);
+	if (i) {
+		if (i->refs++ == 0) __inodeUnlinkLRU (i);
+		return i;
+	}
+	i = calloc (1, sizeof(Inode));
+	if (!i) return NULL;
+	i->d = d;
+	i->number = number;
+	if (load && __inodeReadIn (i) < 0) {
+		free (i);
+		return NULL;
+	}
+	//O numero gravado no setor pode diferir para i-nodes nunca salvos
+	i->number = number;
+	i->refs = 1;
+	i->hashNext = hashTable[__inodeHash (d, number)];
+	hashTable[__inodeHash (d, number)] = i;
 	return i;
 }
 
+//Funcao interna que retorna o indice do bit 0 menos significativo de w, que
+//deve possuir ao menos um bit 0
+static unsigned int __inodeFirstZero (unsigned long long w) {
+#if defined(__GNUC__)
+	return (unsigned int) __builtin_ctzll (~w);
+#else
+	unsigned int n = 0;
+	while (w & 1) {
+		w >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+//Funcao interna que marca um i-node como em uso (used) ou livre no mapa de
+//seu disco, se carregado
+static void __inodeMark (Disk *d, unsigned int number, int used) {
+	InodeArea *a = __inodeArea (d, 0);
+	unsigned long long bit;
+	unsigned int word;
+	if (!a || !a->bitmap || number < 1 || number > a->numInodes) return;
+	word = number / INODE_MAPWORDBITS;
+	bit = 1ULL << (number % INODE_MAPWORDBITS);
+	if (used) a->bitmap[word] |= bit;
+	else {
+		a->bitmap[word] &= ~bit;
+		if (word < a->hint) a->hint = word;
+	}
+	a->dirty = 1;
+}
+
+//Funcao interna que retorna o numero de setores do mapa de i-nodes, com
+//numWords palavras, que contem bits de i-nodes ja' iniciados (ate' o i-node
+//initInodes). Os demais bits sao sempre 0, e seus setores nao sao lidos nem
+//gravados, nem mesmo na formatacao
+static unsigned int __inodeMapSectors (unsigned int numWords,
+                                       unsigned int initInodes) {
+	unsigned int wordsPerSector = INODE_MAPSECTORBITS / INODE_MAPWORDBITS;
+	unsigned int total = (numWords + wordsPerSector - 1) / wordsPerSector;
+	unsigned int used = (initInodes ? initInodes / INODE_MAPSECTORBITS + 1
+	                                : 0);
+	return (used < total ? used : total);
+}
+
+//Funcao interna que grava o mapa de i-nodes de uma area em seus setores, por
+//meio da cache de setores. Apenas os setores com bits de i-nodes iniciados
+//sao gravados. Retorna 0 se bem sucedida e -1 caso contrario
+static int __inodeWriteBitmap (InodeArea *a) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int wordsPerSector = INODE_MAPSECTORBITS / INODE_MAPWORDBITS;
+	unsigned int numSectors = __inodeMapSectors (a->numWords,
+	                                             a->initInodes);
+	for (unsigned int s = 0; s < numSectors; s++) {
+		memset (sector, 0, DISK_SECTORDATASIZE);
+		unsigned int count = a->numWords - s * wordsPerSector;
+		if (count > wordsPerSector) count = wordsPerSector;
+		ull2charArray (&a->bitmap[s * wordsPerSector], count, sector);
+		if (cacheWriteSector (a->d, a->bitmapSector + s, sector) < 0)
+			return -1;
+	}
+	a->dirty = 0;
+	return 0;
+}
+
+//Funcao interna que retorna a profundidade de um no' da arvore de extents
+static unsigned int __extDepth (unsigned int *n) {
+	return (n[0] & ~EXTENT_NODE) >> EXTENT_DEPTHSHIFT;
+}
+
+//Funcao interna que retorna o numero de entradas de um no' da arvore
+static unsigned int __extCount (unsigned int *n) {
+	return n[0] & EXTENT_COUNTMASK;
+}
+
+//Funcao interna que grava o cabecalho de um no' da arvore
+static void __extSetHeader (unsigned int *n, unsigned int node,
+                            unsigned int depth, unsigned int count) {
+	n[0] = (node ? EXTENT_NODE : 0) | (depth << EXTENT_DEPTHSHIFT) | count;
+}
+
+//Funcao interna que retorna o numero maximo de entradas de um no' da arvore
+//com numItems itens
+static unsigned int __extCapacity (unsigned int *n, unsigned int numItems) {
+	return (numItems - 1) / (__extDepth (n) ? EXTENT_INDEXITEMS
+	                                        : EXTENT_LEAFITEMS);
+}
+
+//Funcao interna que retorna os itens da k-esima entrada de um no' da arvore
+static unsigned int* __extEntry (unsigned int *n, unsigned int k) {
+	return &n[1 + k * (__extDepth (n) ? EXTENT_INDEXITEMS
+	                                  : EXTENT_LEAFITEMS)];
+}
+
+//Funcao interna que procura, por busca binaria, a ultima entrada de um no'
+//que se inicia no bloco logico blockNum ou antes dele. Retorna -1 se todas
+//as entradas se iniciam apos blockNum
+static int __extSearch (unsigned int *n, unsigned int blockNum) {
+	int lo = 0, hi = (int) __extCount (n) - 1, found = -1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (__extEntry (n, mid)[0] <= blockNum) {
+			found = mid;
+			lo = mid + 1;
+		}
+		else hi = mid - 1;
+	}
+	return found;
+}
+
+//Funcao interna que retorna o numero de itens de um no' gravado em bloco
+static unsigned int __extNodeItems (Disk *d) {
+	return __inodeBlockSectors (d) * DISK_SECTORDATASIZE
+	       / sizeof(unsigned int);
+}
+
+//Funcao interna que le o no' gravado no bloco blockAddr para n, por meio da
+//cache de setores. Retorna 0 se bem sucedida e -1 caso contrario
+static int __extReadNode (Disk *d, unsigned int blockAddr, unsigned int *n) {
+	unsigned int numItems = __extNodeItems (d);
+	unsigned char *buffer = malloc (numItems * sizeof(unsigned int));
+	int ret = -1;
+	if (!buffer) return -1;
+	if (cacheReadSectors (d, blockAddr, __inodeBlockSectors (d),
+	                      buffer) == 0) {
+		char2ulArray (buffer, numItems, n);
+		//Rejeitando blocos que nao contem nos da arvore
+		if ((n[0] & EXTENT_NODE)
+		    && __extCount (n) <= __extCapacity (n, numItems))
+			ret = 0;
+	}
+	free (buffer);
+	return ret;
+}
+
+//Funcao interna que grava o no' n no bloco blockAddr, por meio da cache de
+//setores. Retorna 0 se bem sucedida e -1 caso contrario
+static int __extWriteNode (Disk *d, unsigned int blockAddr, unsigned int *n) {
+	unsigned int numItems = __extNodeItems (d);
+	unsigned char *buffer = malloc (numItems * sizeof(unsigned int));
+	int ret;
+	if (!buffer) return -1;
+	ul2charArray (n, numItems, buffer);
+	ret = cacheWriteSectors (d, blockAddr, __inodeBlockSectors (d), buffer);
+	free (buffer);
+	return ret;
+}
+
+//Funcao interna que grava um no' de i (a raiz, se blockAddr for 0)
+static int __extSaveNode (Inode *i, unsigned int blockAddr, unsigned int *n) {
+	if (!blockAddr) return inodeSave (i);
+	return __extWriteNode (i->d, blockAddr, n);
+}
+
+//Funcao interna que cria, em n, um no' da arvore de extents com profundidade
+//depth e uma unica entrada {logical, value, length} (length ignorado em nos
+//internos) e o grava em um bloco obtido do sistema de arquivos, proximo ao
+//bloco value. Retorna o endereco do bloco ou 0 em caso de falha
+static unsigned int __extNewNode (Disk *d, unsigned int *n, unsigned int depth,
+                                  unsigned int logical, unsigned int value,
+                                  unsigned int length) {
+	InodeArea *a = __inodeArea (d, 0);
+	unsigned int blockAddr;
+	if (!a || !a->allocFn) return 0;
+	memset (n, 0, __extNodeItems (d) * sizeof(unsigned int));
+	__extSetHeader (n, 1, depth, 1);
+	__extEntry (n, 0)[0] = logical;
+	__extEntry (n, 0)[1] = value;
+	if (!depth) __extEntry (n, 0)[2] = length;
+	blockAddr = a->allocFn (d, value);
+	if (!blockAddr) return 0;
+	if (__extWriteNode (d, blockAddr, n) != 0) {
+		if (a->freeFn) a->freeFn (d, blockAddr);
+		return 0;
+	}
+	return blockAddr;
+}
+
+//Funcao interna que devolve ao sistema de arquivos os blocos de todos os nos
+//abaixo do no' interno n, a partir de sua entrada first. Retorna 0 se bem
+//sucedida e -1 caso contrario
+static int __extFreeTree (Disk *d, unsigned int *n, unsigned int first) {
+	InodeArea *a = __inodeArea (d, 0);
+	unsigned int *child = NULL;
+	int ret = 0;
+	if (!a || !a->freeFn) return -1;
+	if (__extDepth (n) > 1) {
+		child = malloc (__extNodeItems (d) * sizeof(unsigned int));
+		if (!child) return -1;
+	}
+	for (unsigned int k = first; k < __extCount (n) && ret == 0; k++) {
+		unsigned int blockAddr = __extEntry (n, k)[1];
+		if (child && (__extReadNode (d, blockAddr, child) != 0
+		              || __extFreeTree (d, child, 0) != 0))
+			ret = -1;
+		else if (a->freeFn (d, blockAddr) != 0)
+			ret = -1;
+	}
+	free (child);
+	return ret;
+}
+
 //Funcao que retorna o numero de i-nodes por setor
 unsigned int inodeNumInodesPerSector ( void ) {
 	return DISK_SECTORDATASIZE / (INODE_SIZE * sizeof (unsigned int));
@@ -70,36 +612,41 @@ unsigned int inodeNumBlockAddresses ( void ) {
 	return NUMBLOCKS_PERINODE;
 }
 
+//Funcao interna que executa inodeCreate, com a exclusao mutua ja' obtida
+static Inode* __inodeCreate (unsigned int number, Disk *d) {
+	Inode *i;
+	if (__inodeInitUpTo (d, number) < 0) return NULL;
+	i = __inodeGet (number, d, 0);
+	if (!i) return NULL;
+	if ( inodeClear (i) == 0 ) {
+		__inodeMark (d, number, 1);
+		return i;
+	}
+	else inodeRelease (i);
+	return NULL;
+}
+
 //Funcao que cria um i-node vazio, identificado pelo seu numero (number),
 //que deve ser unico no sistema de arquivos. Retorna ponteiro para o i-node
 //criado ou NULL se nao houver memoria suficiente ou number invalido. A funcao
 //salva o i-node em disco, com conteudo vazio e, portanto, o sobrescreve se ja 
 //existente
 Inode* inodeCreate (unsigned int number, Disk *d) {
-	if (number < 1) return NULL;
-	Inode *i = malloc (sizeof(Inode));
-	i->d = d;
-	i->number = number;
-	i->next = 0;
-	if ( inodeClear (i) == 0 ) return i;
-	else free (i);
-	return NULL;
+	Inode *ret;
+	__inodeLock ();
+	ret = __inodeCreate (number, d);
+	__inodeUnlock ();
+	return ret;
 }
 
-//Funcao que limpa todo o conteudo de um i-node. O i-node e' salvo em disco,
-//sobrescrevendo-o se ja existente. Retorna 0 se bem sucedido ou -1, caso contrario
-int inodeClear (Inode *i) {
+//Funcao interna que executa inodeClear, com a exclusao mutua ja' obtida
+static int __inodeClear (Inode *i) {
 	if (i) {
-		if (i->next != 0) {
-			Inode* ni = inodeLoad (i->next, i->d);
-			if ( !ni ) return -1;
-			if ( inodeClear (ni) != 0 ) {
-				free (ni);
-				return -1;
-			}
-			free (ni);
-		}	
-		i->next = 0;
+		if (__extDepth (i->inodeItem) > 0
+		    && __extFreeTree (i->d, i->inodeItem, 0) != 0)
+			return -1;
+		free (i->tail);
+		i->tail = NULL;
 		for (int a = 0; a < NUMITEMS_PERINODE; a++)
 			i->inodeItem[a] = 0;
 		return inodeSave(i);
@@ -107,166 +654,451 @@ int inodeClear (Inode *i) {
 	return -1;
 }
 
+//Funcao que limpa todo o conteudo de um i-node. O i-node e' salvo em disco,
+//sobrescrevendo-o se ja existente. Os blocos dos nos da arvore de extents
+//abaixo da raiz sao devolvidos ao sistema de arquivos. Retorna 0 se bem
+//sucedido ou -1, caso contrario
+int inodeClear (Inode *i) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeClear (i);
+	__inodeUnlock ();
+	return ret;
+}
+
+//Funcao interna que executa inodeFree, com a exclusao mutua ja' obtida
+static int __inodeFree (Inode *i) {
+	if (inodeClear (i) != 0) return -1;
+	__inodeMark (i->d, i->number, 0);
+	return 0;
+}
+
+//Funcao que limpa um i-node, como inodeClear, e o marca como livre no mapa de
+//i-nodes de seu disco. Os blocos de dados do arquivo devem ter sido
+//devolvidos antes ao sistema de arquivos. Retorna 0 se bem sucedido ou -1,
+//caso contrario
+int inodeFree (Inode *i) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeFree (i);
+	__inodeUnlock ();
+	return ret;
+}
+
 //Funcao que persiste um i-node em seu disco. Retorna 0 se gravacao bem sucedida
 //ou -1 caso contrario. I-nodes sao salvos a partir do setor INODE_1STSECTOR. Numero de
 //i-nodes por setor pode variar de acordo com o tamanho do tipo unsigned int
 //Em arquiteturas de 64 bits testadas, unsigned int ocupa 32 bits. Nesse caso,
-//cada setor pode receber 8 i-nodes 
+//cada setor pode receber 8 i-nodes. A gravacao no setor e' adiada ate' o
+//descarte do i-node da cache ou ate' inodeSync
 int inodeSave (Inode *i) {
 	if (i) {
-		unsigned long int sizeUInt = sizeof(unsigned int);
-		//Endereco do setor no qual o i-node sera' salvo
-		unsigned long int inodeSectorAddr = 
-			INODE_BEGINSECTOR + (i->number - 1) * INODE_SIZE 
-			* sizeUInt / DISK_SECTORDATASIZE;
-		unsigned char sector[DISK_SECTORDATASIZE];
-
-		int ret = diskReadSector (i->d, inodeSectorAddr, sector);
-		if (ret < 0) return ret;
-
-		//Posicao de inicio do i-node dentro do setor
-		unsigned long int offset = ((i->number - 1) % 
-			   (DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
-                           * INODE_SIZE * sizeUInt;
-
-		//Alterando enderecos de blocos e atributos do i-node no setor
-		for (int a=0; a < NUMITEMS_PERINODE; a++)
-			ul2char (i->inodeItem[a], 
-			         &sector[offset+a*sizeUInt]);
-		ul2char (i->number, 
-		         &sector[offset+(INODE_SIZE-2)*sizeUInt]);
-		ul2char (i->next, 
-			 &sector[offset+(INODE_SIZE-1)*sizeUInt]);
-
-		//Salvando todo o setor onde se encontra o i-node...
-		ret = diskWriteSector (i->d, inodeSectorAddr, sector);
-		return ret;
+		i->dirty = 1;
+		return 0;
 	}
 	return -1;
 }
 
 //Funcao que recupera um i-node a partir do disco. Retorna ponteiro para o
-//i-node lido ou NULL em caso de falha.
+//i-node lido ou NULL em caso de falha. O i-node e' lido de seu setor apenas
+//se nao estiver na cache e deve ser liberado com inodeRelease
 Inode* inodeLoad (unsigned int number, Disk *d) {
-	unsigned long int sizeUInt = sizeof(unsigned int);
-	//Endereco do setor do qual o i-node sera' lido
-	unsigned long int inodeSectorAddr = 
-		INODE_BEGINSECTOR + (number - 1) * INODE_SIZE * sizeUInt
-		    / DISK_SECTORDATASIZE;
-	unsigned char sector[DISK_SECTORDATASIZE];
-	Inode *i = NULL;
+	Inode *i;
+	__inodeLock ();
+	i = __inodeGet (number, d, 1);
+	__inodeUnlock ();
+	return i;
+}
 
-	int ret = diskReadSector (d, inodeSectorAddr, sector);
-	if (ret < 0) return NULL;
+//Funcao interna que executa inodeRelease, com a exclusao mutua ja' obtida
+static void __inodeRelease (Inode *i) {
+	if (!i || i->refs == 0) return;
+	if (--i->refs > 0) return;
+	i->lruPrev = NULL;
+	i->lruNext = lruHead;
+	if (lruHead) lruHead->lruPrev = i;
+	else lruTail = i;
+	lruHead = i;
+	lruLen++;
+	__inodeTrim (i->d);
+}
 
-	//Posicao de inicio do i-node dentro do setor
-	unsigned long int offset = ((number - 1) % 
-		(DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
-		* INODE_SIZE * sizeUInt;
+//Funcao que libera uma referencia a um i-node obtida por inodeLoad ou
+//inodeCreate. Sem referencias, o i-node permanece na cache ate' ser descartado
+void inodeRelease (Inode *i) {
+	__inodeLock ();
+	__inodeRelease (i);
+	__inodeUnlock ();
+}
 
-	i = malloc (sizeof(Inode));
-	if (i) {
-		i->d = d;
-		//Recuperando enderecos de blocos e atributos do i-node no setor
-		for (int a=0; a < NUMITEMS_PERINODE; a++)
-			char2ul (&sector[offset+a*sizeUInt],
-			         &(i->inodeItem[a]));
-		char2ul (&sector[offset+(INODE_SIZE-2)*sizeUInt],
-		         &(i->number));
-		char2ul (&sector[offset+(INODE_SIZE-1)*sizeUInt],
-		         &(i->next));
+//Funcao que grava em seus setores os i-nodes alterados de um disco mantidos
+//na cache, ou de todos os discos se d for NULL (quando nenhum sistema de
+//arquivos pode estar alterando i-nodes). Retorna 0 se bem sucedida e -1 caso
+//contrario
+int inodeSync (Disk *d) {
+	int ret = 0;
+	__inodeLock ();
+	for (int h = 0; h < INODE_HASHSIZE; h++)
+		for (Inode *i = hashTable[h]; i; i = i->hashNext)
+			if ((!d || i->d == d) && i->dirty
+			    && __inodeWriteBack (i, i->d) < 0)
+				ret = -1;
+	for (int k = 0; k < INODE_MAXDISKS; k++)
+		if (areas[k].bitmap && areas[k].dirty
+		    && (!d || areas[k].d == d)
+		    && __inodeWriteBitmap (&areas[k]) < 0)
+			ret = -1;
+	__inodeUnlock ();
+	return ret;
+}
+
+//Funcao que descarta da cache os i-nodes sem referencias de um disco, sem
+//grava-los. Deve ser precedida por inodeSync para que nao haja perda de dados
+void inodeInvalidate (Disk *d) {
+	__inodeLock ();
+	for (int h = 0; h < INODE_HASHSIZE; h++) {
+		Inode **p = &hashTable[h];
+		while (*p) {
+			Inode *i = *p;
+			if (i->d != d || i->refs > 0) {
+				p = &i->hashNext;
+				continue;
+			}
+			*p = i->hashNext;
+			__inodeUnlinkLRU (i);
+			free (i->tail);
+			free (i);
+		}
 	}
-	return i;
+	for (int k = 0; k < INODE_MAXDISKS; k++)
+		if (areas[k].d == d) {
+			free (areas[k].bitmap);
+			memset (&areas[k], 0, sizeof(InodeArea));
+		}
+	__inodeUnlock ();
 }
 
 //Funcao que modifica o tipo de arquivo referente a um i-node
 void inodeSetFileType (Inode *i, unsigned int fileType) {
-	if (i) i->inodeItem[INODE_ITEM_FILETYPE] = fileType;
+	if (i) {
+		i->inodeItem[INODE_ITEM_FILETYPE] = fileType;
+		i->dirty = 1;
+	}
 }
 
 //Funcao que modifica o tamanho do arquivo referente a um i-node, em bytes
 void inodeSetFileSize (Inode *i, unsigned int fileSize) {
-	if (i) i->inodeItem[INODE_ITEM_FILESIZE] = fileSize;
+	if (i) {
+		i->inodeItem[INODE_ITEM_FILESIZE] = fileSize;
+		i->dirty = 1;
+	}
 }
 
 //Funcao que modifica o proprietario do arquivo referente a um i-node
 void inodeSetOwner (Inode *i, unsigned int owner) {
-	if (i) i->inodeItem[INODE_ITEM_OWNER] = owner;
+	if (i) {
+		i->inodeItem[INODE_ITEM_OWNER] = owner;
+		i->dirty = 1;
+	}
 }
 
 //Funcao que modifica o grupo proprietario do arquivo referente a um i-node
 void inodeSetGroupOwner (Inode *i, unsigned int groupOwner) {
-	if (i) i->inodeItem[INODE_ITEM_GROUPOWNER] = groupOwner;
+	if (i) {
+		i->inodeItem[INODE_ITEM_GROUPOWNER] = groupOwner;
+		i->dirty = 1;
+	}
 }
 
 //Funcao que modifica as permissoes de acesso ao arquivo referente a um i-node
 void inodeSetPermission (Inode *i, unsigned int permission) {
-	if (i) i->inodeItem[INODE_ITEM_PERMISSION] = permission;
+	if (i) {
+		i->inodeItem[INODE_ITEM_PERMISSION] = permission;
+		i->dirty = 1;
+	}
 }
 
 //Funcao que modifica o contador de referencia do arquivo referente a um i-node
 void inodeSetRefCount (Inode *i, unsigned int refCount) {
-	if (i) i->inodeItem[INODE_ITEM_REFCOUNT] = refCount;
+	if (i) {
+		i->inodeItem[INODE_ITEM_REFCOUNT] = refCount;
+		i->dirty = 1;
+	}
 }
 
-//Funcao que adiciona um endereco ao fim do array de blocos de um i-node
-//Retorna -1 caso a inclusao do endereco nao seja bem sucedida
-//E' a unica funcao que salva automaticamente o i-node em disco
-int inodeAddBlock (Inode *i, unsigned int blockAddr) {
+//Funcao interna que inclui o bloco blockAddr no fim da folha n de i, gravada
+//em leafAddr (a raiz, se 0), estendendo seu ultimo extent se o bloco for
+//contiguo a ele. Retorna 0 se bem sucedida, 1 se a folha estiver cheia (com
+//o bloco logico do novo extent em *logical) e -1 em caso de erro
+static int __extLeafAppend (Inode *i, unsigned int *n, unsigned int leafAddr,
+                            unsigned int blockAddr, unsigned int *logical) {
+	unsigned int numItems = leafAddr ? __extNodeItems (i->d)
+	                                 : NUMBLOCKS_PERINODE;
+	unsigned int *e;
+	*logical = 0;
+	if (__extCount (n) > 0) {
+		e = __extEntry (n, __extCount (n) - 1);
+		*logical = e[0] + e[2];
+		//Bloco contiguo ao ultimo: estende o extent
+		if (e[1] + e[2] * __inodeBlockSectors (i->d) == blockAddr) {
+			e[2]++;
+			return (__extSaveNode (i, leafAddr, n) == 0 ? 0 : -1);
+		}
+	}
+	if (__extCount (n) >= __extCapacity (n, numItems)) return 1;
+	e = __extEntry (n, __extCount (n));
+	e[0] = *logical;
+	e[1] = blockAddr;
+	e[2] = 1;
+	__extSetHeader (n, leafAddr != 0, 0, __extCount (n) + 1);
+	return (__extSaveNode (i, leafAddr, n) == 0 ? 0 : -1);
+}
+
+//Funcao interna que executa inodeAddBlock, com a exclusao mutua ja' obtida
+static int __inodeAddBlock (Inode *i, unsigned int blockAddr) {
 	if (i) {
-		Disk *d = i->d;
-		Inode* lastInodeExt = NULL;
-		unsigned int niNumber;
-		int ret, numblocks = NUMBLOCKS_PERINODE;
-		lastInodeExt = __inodeGetLastExtension (i);
-		if (lastInodeExt) {
-			numblocks = NUMITEMS_PERINODE;
-			if ( inodeSave (i) < 0 ) return -1;
+		unsigned int *path[EXTENT_MAXDEPTH + 1];
+		unsigned int addrs[EXTENT_MAXDEPTH + 1];
+		unsigned int fresh[EXTENT_MAXDEPTH + 2];
+		unsigned int nodeItems = __extNodeItems (i->d);
+		unsigned int *n, *e, *scratch = NULL, logical = 0, newNode;
+		InodeArea *a = __inodeArea (i->d, 0);
+		int level = 0, numFresh = 0, ret;
+
+		if (i->tail && __extDepth (i->inodeItem) > 0) {
+			ret = __extLeafAppend (i, i->tail, i->tailAddr,
+			                       blockAddr, &logical);
+			if (ret == 0) return 0;
+			//Em erro, a copia em memoria ja' foi alterada e nao
+			//corresponde mais ao disco: e' descartada, sendo a folha
+			//lida novamente na proxima inclusao
+			if (ret < 0) {
+				free (i->tail);
+				i->tail = NULL;
+				return -1;
+			}
+		}
+		free (i->tail);
+		i->tail = NULL;
+		ret = -1;
+
+		//Descendo pela borda direita da arvore ate' a folha
+		path[0] = i->inodeItem;
+		addrs[0] = 0;
+		while (__extDepth (path[level]) > 0) {
+			n = path[level];
+			if (level == EXTENT_MAXDEPTH) goto out;
+			path[level+1] = malloc (nodeItems * sizeof(unsigned int));
+			if (!path[level+1]) goto out;
+			level++;
+			addrs[level] = __extEntry (n, __extCount (n) - 1)[1];
+			if (__extReadNode (i->d, addrs[level], path[level]) != 0)
+				goto out;
 		}
-		else if (i->next != 0) return -1;
-		else lastInodeExt = i;
-
-		for (int a = 0; a < numblocks; a++)
-			//Encontrar bloco sem endereco
-			if (lastInodeExt->inodeItem[a] == 0) {
-				lastInodeExt->inodeItem[a] = blockAddr;
-				ret = inodeSave(lastInodeExt);
-				if (numblocks != NUMBLOCKS_PERINODE) 
-					free (lastInodeExt);
-				return ret;
+
+		ret = __extLeafAppend (i, path[level], addrs[level], blockAddr,
+		                       &logical);
+		if (ret <= 0) {
+			//Guardando a folha mais a direita junto ao i-node
+			if (ret == 0 && level > 0) {
+				i->tail = path[level];
+				i->tailAddr = addrs[level];
+				level--;
 			}
-		//i-node esta' sem bloco a preencher. Obter nova extensao
-		niNumber = inodeFindFreeInode (lastInodeExt->number, d);
-		if (niNumber) {
-			lastInodeExt->next = niNumber;
-			ret = inodeSave (lastInodeExt);
-			if (numblocks != NUMBLOCKS_PERINODE) 
-				free (lastInodeExt);
-			if (ret < 0) return ret;
+			goto out;
 		}
-		else {
-			if (numblocks != NUMBLOCKS_PERINODE)
-				free (lastInodeExt);
-			return -1;
+		ret = -1;
+
+		//Folha cheia: nova folha, incluida no primeiro ancestral com
+		//espaco, criando nos internos nos niveis cheios
+		scratch = malloc (nodeItems * sizeof(unsigned int));
+		if (!scratch) goto out;
+		newNode = __extNewNode (i->d, scratch, 0, logical, blockAddr, 1);
+		if (!newNode) goto out;
+		fresh[numFresh++] = newNode;
+		for (int k = level - 1; k >= 0; k--) {
+			n = path[k];
+			if (__extCount (n) < __extCapacity (n, k ? nodeItems
+			                                         : NUMBLOCKS_PERINODE)) {
+				e = __extEntry (n, __extCount (n));
+				e[0] = logical;
+				e[1] = newNode;
+				__extSetHeader (n, k > 0, __extDepth (n),
+				                __extCount (n) + 1);
+				ret = __extSaveNode (i, addrs[k], n);
+				//Desfazendo a inclusao no no' em memoria
+				if (ret != 0)
+					__extSetHeader (n, k > 0, __extDepth (n),
+					                __extCount (n) - 1);
+				goto out;
+			}
+			newNode = __extNewNode (i->d, scratch, __extDepth (n),
+			                        logical, newNode, 0);
+			if (!newNode) goto out;
+			fresh[numFresh++] = newNode;
 		}
-		lastInodeExt = inodeLoad (niNumber, d);
-		if (!lastInodeExt) return -1;
-		lastInodeExt->inodeItem[0] = blockAddr;
-		ret = inodeSave (lastInodeExt);
-		free (lastInodeExt);
+
+		//Raiz cheia: suas entradas passam a um novo no' e a raiz ganha
+		//um nivel, apontando para ele e para o novo ramo
+		{
+			InodeArea *a = __inodeArea (i->d, 0);
+			unsigned int depth = __extDepth (i->inodeItem);
+			unsigned int count = __extCount (i->inodeItem);
+			unsigned int items = count * (depth ? EXTENT_INDEXITEMS
+			                                    : EXTENT_LEAFITEMS);
+			unsigned int moved;
+			if (depth + 1 > EXTENT_MAXDEPTH) goto out;
+			memset (scratch, 0, nodeItems * sizeof(unsigned int));
+			for (unsigned int k = 0; k < items; k++)
+				scratch[1 + k] = i->inodeItem[1 + k];
+			__extSetHeader (scratch, 1, depth, count);
+			moved = a->allocFn (i->d, __extEntry (scratch, 0)[1]);
+			if (!moved) goto out;
+			fresh[numFresh++] = moved;
+			if (__extWriteNode (i->d, moved, scratch) != 0) goto out;
+			for (unsigned int k = 1; k < NUMBLOCKS_PERINODE; k++)
+				i->inodeItem[k] = 0;
+			__extSetHeader (i->inodeItem, 0, depth + 1, 2);
+			__extEntry (i->inodeItem, 0)[0] = 0;
+			__extEntry (i->inodeItem, 0)[1] = moved;
+			__extEntry (i->inodeItem, 1)[0] = logical;
+			__extEntry (i->inodeItem, 1)[1] = newNode;
+			ret = inodeSave (i);
+			//Desfazendo a mudanca da raiz em memoria
+			if (ret != 0) {
+				for (unsigned int k = 1; k < NUMBLOCKS_PERINODE; k++)
+					i->inodeItem[k] = k <= items ? scratch[k] : 0;
+				__extSetHeader (i->inodeItem, 0, depth, count);
+			}
+		}
+out:
+		//Devolvendo os blocos dos nos criados nesta chamada
+		if (ret != 0 && a && a->freeFn)
+			while (numFresh > 0) a->freeFn (i->d, fresh[--numFresh]);
+		free (scratch);
+		for (int k = 1; k <= level; k++) free (path[k]);
 		return ret;
 	}
 	return -1;
 }
 
-//Funcao que retorna o numero de um i-node.
-unsigned int inodeGetNumber (Inode *i) {
-	return (i ? i->number : 0);
+//Funcao que adiciona um endereco ao fim do array de blocos de um i-node
+//Retorna -1 caso a inclusao do endereco nao seja bem sucedida
+//E' a unica funcao que salva automaticamente o i-node em disco. Um bloco
+//fisicamente contiguo ao ultimo bloco do arquivo apenas estende o ultimo
+//extent; caso contrario, um novo extent e' incluido na folha mais a direita
+//da arvore, criando nos (e aumentando a profundidade) quando necessario. A
+//folha mais a direita fica em memoria junto ao i-node, de modo que a inclusao
+//so' le blocos da arvore quando a folha precisa ser dividida. Em caso de
+//falha, os blocos obtidos para novos nos sao devolvidos ao sistema de arquivos
+int inodeAddBlock (Inode *i, unsigned int blockAddr) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeAddBlock (i, blockAddr);
+	__inodeUnlock ();
+	return ret;
+}
+
+//Funcao interna que remove do no' n de i, gravado no bloco nodeAddr (a raiz,
+//se 0), os blocos logicos a partir de numBlocks (maior que 0). Os ramos da
+//borda direita que ficam sem blocos sao devolvidos ao sistema de arquivos e
+//o ultimo extent mantido e' encurtado. Retorna 0 se bem sucedida e -1 caso
+//contrario
+static int __extTrim (Inode *i, unsigned int *n, unsigned int nodeAddr,
+                      unsigned int numBlocks) {
+	unsigned int count = __extCount (n);
+	unsigned int *e;
+	//Entradas iniciadas a partir de numBlocks (nunca a primeira)
+	while (count > 1 && __extEntry (n, count - 1)[0] >= numBlocks) count--;
+	if (__extDepth (n) > 0 && __extFreeTree (i->d, n, count) != 0)
+		return -1;
+	__extSetHeader (n, nodeAddr != 0, __extDepth (n), count);
+	e = __extEntry (n, count - 1);
+	if (__extDepth (n) == 0) {
+		if (e[0] + e[2] > numBlocks) e[2] = numBlocks - e[0];
+	}
+	else {
+		unsigned int *child = malloc (__extNodeItems (i->d)
+		                              * sizeof(unsigned int));
+		int ret = -1;
+		if (!child) return -1;
+		if (__extReadNode (i->d, e[1], child) == 0)
+			ret = __extTrim (i, child, e[1], numBlocks);
+		free (child);
+		if (ret != 0) return -1;
+	}
+	return __extSaveNode (i, nodeAddr, n);
+}
+
+//Funcao interna que executa inodeTruncate, com a exclusao mutua ja' obtida
+static int __inodeTruncate (Inode *i, unsigned int numBlocks) {
+	if (!i) return -1;
+	free (i->tail);
+	i->tail = NULL;
+	if (numBlocks > 0 && __extCount (i->inodeItem) > 0)
+		return __extTrim (i, i->inodeItem, 0, numBlocks);
+	if (__extDepth (i->inodeItem) > 0
+	    && __extFreeTree (i->d, i->inodeItem, 0) != 0)
+		return -1;
+	for (int a = 0; a < NUMBLOCKS_PERINODE; a++)
+		i->inodeItem[INODE_ITEM_BLOCKADDR + a] = 0;
+	return inodeSave (i);
+}
+
+//Funcao que remove do fim do array de blocos de um i-node os blocos a partir
+//do bloco numBlocks, mantendo os numBlocks primeiros. Apenas a borda direita
+//da arvore de extents e' percorrida, e os nos que ficam sem blocos sao
+//devolvidos ao sistema de arquivos. Os blocos de dados removidos nao sao
+//devolvidos: cabe ao sistema de arquivos obte-los antes, por um cursor.
+//Retorna 0 se bem sucedido ou -1, caso contrario
+int inodeTruncate (Inode *i, unsigned int numBlocks) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeTruncate (i, numBlocks);
+	__inodeUnlock ();
+	return ret;
+}
+
+//Funcao interna que executa inodeGetNumBlocks, com a exclusao mutua ja' obtida
+static unsigned int __inodeGetNumBlocks (Inode *i) {
+	unsigned int *n, *e, *node = NULL, numBlocks = 0;
+	if (!i || __extCount (i->inodeItem) == 0) return 0;
+	n = i->inodeItem;
+	if (__extDepth (n) > 0 && i->tail) n = i->tail;
+	while (__extDepth (n) > 0) {
+		if (!node) {
+			node = malloc (__extNodeItems (i->d) * sizeof(unsigned int));
+			if (!node) return 0;
+		}
+		if (__extReadNode (i->d, __extEntry (n, __extCount (n) - 1)[1],
+		                   node) != 0) {
+			free (node);
+			return 0;
+		}
+		n = node;
+	}
+	if (__extCount (n) > 0) {
+		e = __extEntry (n, __extCount (n) - 1);
+		numBlocks = e[0] + e[2];
+	}
+	free (node);
+	return numBlocks;
+}
+
+//Funcao que retorna o numero de blocos do array de blocos de um i-node, isto
+//e', o bloco logico seguinte ao ultimo extent. Apenas a borda direita da
+//arvore de extents e' percorrida. Retorna 0 em caso de falha
+unsigned int inodeGetNumBlocks (Inode *i) {
+	unsigned int ret;
+	__inodeLock ();
+	ret = __inodeGetNumBlocks (i);
+	__inodeUnlock ();
+	return ret;
 }
 
 //Funcao que retorna o numero de um i-node.
-unsigned int inodeGetNextNumber (Inode *i) {
-	return (i ? i->next : 0);
+unsigned int inodeGetNumber (Inode *i) {
+	return (i ? i->number : 0);
 }
 
 
@@ -304,45 +1136,318 @@ unsigned int inodeGetRefCount (Inode *i) {
 }
 
 
+//Funcao interna que posiciona o cursor m no extent que contem seu bloco
+//corrente. A folha ja' mantida em memoria e' consultada primeiro; a arvore so'
+//e' percorrida a partir da raiz quando o bloco esta' fora dela. Retorna o
+//endereco do bloco corrente ou 0 se ele nao possuir endereco
+static unsigned int __inodeMapFind (InodeMap *m) {
+	unsigned int *root = m->inode->inodeItem;
+	unsigned int *n = (__extDepth (root) ? m->leaf : root);
+	int k = -1;
+	if (m->block - m->extStart < m->extLen)
+		return m->extAddr + (m->block - m->extStart) * m->stride;
+	if (n) k = __extSearch (n, m->block);
+	//Blocos recem incluidos estao na folha mais a direita, se em memoria
+	if ((k < 0 || m->block >= __extEntry (n, k)[0] + __extEntry (n, k)[2])
+	    && n != root && m->inode->tail) {
+		n = m->inode->tail;
+		k = __extSearch (n, m->block);
+	}
+	if (k < 0 || m->block >= __extEntry (n, k)[0] + __extEntry (n, k)[2]) {
+		if (n == root) return 0;
+		//Descendo da raiz, mantendo em memoria apenas a folha
+		if (!m->leaf) {
+			m->leaf = malloc (__extNodeItems (m->inode->d)
+			                  * sizeof(unsigned int));
+			if (!m->leaf) return 0;
+		}
+		n = root;
+		while (__extDepth (n) > 0) {
+			k = __extSearch (n, m->block);
+			if (k < 0 || __extReadNode (m->inode->d,
+			                            __extEntry (n, k)[1],
+			                            m->leaf) != 0) {
+				free (m->leaf);
+				m->leaf = NULL;
+				return 0;
+			}
+			n = m->leaf;
+		}
+		k = __extSearch (n, m->block);
+		if (k < 0 || m->block >= __extEntry (n, k)[0]
+		                         + __extEntry (n, k)[2])
+			return 0;
+	}
+	m->extStart = __extEntry (n, k)[0];
+	m->extAddr = __extEntry (n, k)[1];
+	m->extLen = __extEntry (n, k)[2];
+	return m->extAddr + (m->block - m->extStart) * m->stride;
+}
+
+//Funcao interna que executa inodeMapBegin, com a exclusao mutua ja' obtida
+static int __inodeMapBegin (InodeMap *m, Inode *i, unsigned int blockNum) {
+	if (!m || !i) return -1;
+	m->inode = i;
+	m->leaf = NULL;
+	m->block = blockNum;
+	m->stride = __inodeBlockSectors (i->d);
+	m->extStart = m->extAddr = m->extLen = 0;
+	return 0;
+}
+
+//Funcao que inicia um cursor (m) sobre o mapa de blocos de um i-node,
+//posicionado no bloco blockNum. Retorna 0 se bem sucedido ou -1, caso
+//contrario
+int inodeMapBegin (InodeMap *m, Inode *i, unsigned int blockNum) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeMapBegin (m, i, blockNum);
+	__inodeUnlock ();
+	return ret;
+}
+
+//Funcao que retorna o endereco do bloco corrente de um cursor, sem avanca-lo.
+//Retorna 0 se o bloco nao possuir endereco
+unsigned int inodeMapPeek (InodeMap *m) {
+	unsigned int addr;
+	if (!m || !m->inode) return 0;
+	__inodeLock ();
+	addr = __inodeMapFind (m);
+	__inodeUnlock ();
+	return addr;
+}
+
+//Funcao que retorna o endereco do bloco corrente de um cursor e o avanca para
+//o bloco seguinte. Retorna 0 se o bloco nao possuir endereco
+unsigned int inodeMapNext (InodeMap *m) {
+	unsigned int addr = inodeMapPeek (m);
+	if (m && m->inode) m->block++;
+	return addr;
+}
+
+//Funcao que encerra um cursor, liberando a folha mantida em memoria
+void inodeMapEnd (InodeMap *m) {
+	if (!m) return;
+	free (m->leaf);
+	m->leaf = NULL;
+	m->inode = NULL;
+}
+
 //Funcao que retorna o endereco correspondente a um bloco (blockNum) no array
-//de blocos de um i-node. O i-node precisa ser o primeiro de sua cadeia.
-//Retorna 0 se o bloco nao possuir endereco em blockNum
+//de blocos de um i-node, cujos itens de blocos guardam a raiz da arvore de
+//extents. Retorna 0 se o bloco nao possuir endereco em blockNum. A busca
+//percorre a arvore da raiz ate' a folha, por busca binaria em cada no'
 unsigned int inodeGetBlockAddr (Inode *i, unsigned int blockNum) {
-	unsigned int numblocks = NUMBLOCKS_PERINODE;
-	if (i) {
-		if (blockNum < NUMBLOCKS_PERINODE)
-			return i->inodeItem[blockNum];
-		else {
-			unsigned int extNum = 1 + 
-			                      (blockNum - NUMBLOCKS_PERINODE) 
-			                      / NUMITEMS_PERINODE;
-			unsigned int offset = (blockNum - NUMBLOCKS_PERINODE)
-			                      % NUMITEMS_PERINODE;
-			Inode *ni = inodeLoad (i->next, i->d);
-			for (int a = 1; a < extNum; a++) {
-				Disk *d = ni->d;
-				unsigned int niNumber = ni->next;
-				free (ni);
-				ni = inodeLoad (niNumber, d);
-			}
-			return ni->inodeItem[offset];
+	InodeMap m;
+	unsigned int addr;
+	if (inodeMapBegin (&m, i, blockNum) != 0) return 0;
+	addr = inodeMapPeek (&m);
+	inodeMapEnd (&m);
+	return addr;
+}
+
+//Funcao interna que executa inodeSetBlockSize, com a exclusao mutua ja' obtida
+static void __inodeSetBlockSize (Disk *d, unsigned int blockSize) {
+	InodeArea *a = __inodeArea (d, 1);
+	if (!a) return;
+	a->blockSectors = blockSize / DISK_SECTORDATASIZE;
+	if (!a->blockSectors) a->blockSectors = 1;
+}
+
+//Funcao que informa o tamanho de bloco, em bytes, do sistema de arquivos de
+//um disco. Ele e' usado para reconhecer blocos fisicamente contiguos, que
+//passam a ser descritos por um unico extent
+void inodeSetBlockSize (Disk *d, unsigned int blockSize) {
+	__inodeLock ();
+	__inodeSetBlockSize (d, blockSize);
+	__inodeUnlock ();
+}
+
+//Funcao interna que executa inodeSetAllocator, com a exclusao mutua ja' obtida
+static void __inodeSetAllocator (Disk *d,
+                  unsigned int (*allocFn)(Disk *d, unsigned int goal),
+                  int (*freeFn)(Disk *d, unsigned int blockAddr)) {
+	InodeArea *a = __inodeArea (d, 1);
+	if (!a) return;
+	a->allocFn = allocFn;
+	a->freeFn = freeFn;
+}
+
+//Funcao que informa as funcoes do sistema de arquivos de um disco para obter
+//(allocFn) e devolver (freeFn) os blocos de dados usados pelos nos da arvore
+//de extents
+void inodeSetAllocator (Disk *d,
+                        unsigned int (*allocFn)(Disk *d, unsigned int goal),
+                        int (*freeFn)(Disk *d, unsigned int blockAddr)) {
+	__inodeLock ();
+	__inodeSetAllocator (d, allocFn, freeFn);
+	__inodeUnlock ();
+}
+
+//Funcao interna que executa inodeAddRegion, com a exclusao mutua ja' obtida
+static int __inodeAddRegion (Disk *d, unsigned long startSector,
+                             unsigned int numInodes) {
+	unsigned int perSector = inodeNumInodesPerSector ();
+	InodeArea *a = __inodeArea (d, 1);
+	InodeRegion *r;
+	if (!a || !numInodes || numInodes % perSector) return -1;
+	if (a->bitmap && a->numInodes + numInodes > a->maxInodes) return -1;
+	r = (a->numRegions ? &a->regions[a->numRegions - 1] : NULL);
+	if (r && r->start + r->count / perSector == startSector)
+		r->count += numInodes;
+	else {
+		if (a->numRegions == INODE_MAXREGIONS) return -1;
+		r = &a->regions[a->numRegions++];
+		r->start = startSector;
+		r->first = a->numInodes + 1;
+		r->count = numInodes;
+	}
+	if (a->bitmap) {
+		for (unsigned int n = a->numInodes + 1;
+		     n <= a->numInodes + numInodes; n++)
+			a->bitmap[n / INODE_MAPWORDBITS] &=
+				~(1ULL << (n % INODE_MAPWORDBITS));
+		if ((a->numInodes + 1) / INODE_MAPWORDBITS < a->hint)
+			a->hint = (a->numInodes + 1) / INODE_MAPWORDBITS;
+		a->dirty = 1;
+	}
+	a->numInodes += numInodes;
+	return 0;
+}
+
+//Funcao que inclui na tabela de i-nodes de um disco uma regiao de numInodes
+//i-nodes, a partir do setor startSector, numerados apos os ja' existentes.
+//Uma regiao contigua a ultima apenas a estende. Com o mapa de i-nodes
+//carregado, os novos i-nodes passam a estar livres. Retorna 0 se bem sucedido
+//ou -1 caso contrario
+int inodeAddRegion (Disk *d, unsigned long startSector,
+                    unsigned int numInodes) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeAddRegion (d, startSector, numInodes);
+	__inodeUnlock ();
+	return ret;
+}
+
+//Funcao interna que executa inodeLoadBitmap, com a exclusao mutua ja' obtida
+static int __inodeLoadBitmap (Disk *d, unsigned int maxInodes,
+                              unsigned long bitmapSector,
+                              unsigned int initInodes) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int wordsPerSector = INODE_MAPSECTORBITS / INODE_MAPWORDBITS;
+	unsigned int numWords = maxInodes / INODE_MAPWORDBITS + 1;
+	unsigned long long *bitmap;
+	InodeArea *a;
+	if (!d || maxInodes < 1) return -1;
+	a = __inodeArea (d, 1);
+	if (!a) return -1;
+	if (!a->numRegions
+	    && inodeAddRegion (d, INODE_BEGINSECTOR, maxInodes) != 0)
+		return -1;
+	if (a->numInodes > maxInodes) return -1;
+	if (initInodes > a->numInodes) initInodes = a->numInodes;
+	bitmap = calloc (numWords, sizeof(unsigned long long));
+	if (!bitmap) return -1;
+	//Setores alem dos i-nodes iniciados nao sao lidos: seus bits sao 0
+	for (unsigned int w = 0;
+	     w < __inodeMapSectors (numWords, initInodes) * wordsPerSector;
+	     w += wordsPerSector) {
+		unsigned int count = numWords - w;
+		if (count > wordsPerSector) count = wordsPerSector;
+		if (cacheReadSector (d, bitmapSector + w / wordsPerSector,
+		                     sector) < 0) {
+			free (bitmap);
+			return -1;
 		}
+		char2ullArray (sector, count, &bitmap[w]);
 	}
+	//O i-node 0 e os bits apos o ultimo i-node nunca estao livres
+	bitmap[0] |= 1;
+	for (unsigned int n = a->numInodes + 1;
+	     n < numWords * INODE_MAPWORDBITS; n++)
+		bitmap[n / INODE_MAPWORDBITS] |= 1ULL << (n % INODE_MAPWORDBITS);
+	free (a->bitmap);
+	a->bitmap = bitmap;
+	a->numWords = numWords;
+	a->maxInodes = maxInodes;
+	a->initInodes = initInodes;
+	a->bitmapSector = bitmapSector;
+	a->hint = 0;
+	a->dirty = 0;
 	return 0;
 }
 
-//Funcao que encontra um i-node livre em um disco, a partir do i-node de numero
-//startFrom. Retorna o numero do inode livre encontrado ou 0 se nao encontrado.
-unsigned int inodeFindFreeInode (unsigned int startFrom, Disk *d) {
+//Funcao que carrega o mapa de i-nodes em uso de um disco, com capacidade para
+//maxInodes i-nodes, gravado a partir do setor bitmapSector. As regioes da
+//tabela devem ter sido informadas antes por inodeAddRegion; sem elas, a
+//tabela e' uma unica regiao de maxInodes i-nodes a partir do setor
+//INODE_BEGINSECTOR. Apenas os setores dos primeiros initInodes i-nodes estao
+//iniciados em disco. A partir de entao, a busca por i-nodes livres e' feita no
+//mapa em memoria. Retorna 0 se bem sucedido ou -1 caso contrario
+int inodeLoadBitmap (Disk *d, unsigned int maxInodes,
+                     unsigned long bitmapSector, unsigned int initInodes) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeLoadBitmap (d, maxInodes, bitmapSector, initInodes);
+	__inodeUnlock ();
+	return ret;
+}
+
+//Funcao que retorna quantos i-nodes, a partir do primeiro, estao iniciados na
+//tabela de i-nodes de um disco, para registro pelo sistema de arquivos
+unsigned int inodeGetInitCount (Disk *d) {
+	InodeArea *a;
+	unsigned int count;
+	__inodeLock ();
+	a = __inodeArea (d, 0);
+	count = (a ? a->initInodes : 0);
+	__inodeUnlock ();
+	return count;
+}
+
+//Funcao interna que executa inodeFindFreeInode, com a exclusao mutua ja' obtida
+static unsigned int __inodeFindFreeInode (unsigned int startFrom, Disk *d) {
+	InodeArea *area = __inodeArea (d, 0);
 	Inode *i = NULL;
 	unsigned int number = 0;
 	if (startFrom < 1) return 0;
+	if (area && area->bitmap) {
+		unsigned int word = startFrom / INODE_MAPWORDBITS;
+		unsigned long long w;
+		if (startFrom > area->numInodes) return 0;
+		//Palavras antes de hint estao cheias
+		if (word < area->hint) word = area->hint;
+		//Ignorando os bits anteriores a startFrom na primeira palavra
+		w = area->bitmap[word];
+		if (word == startFrom / INODE_MAPWORDBITS)
+			w |= (1ULL << (startFrom % INODE_MAPWORDBITS)) - 1;
+		while (w == ~0ULL) {
+			if (word == area->hint && area->bitmap[word] == ~0ULL)
+				area->hint++;
+			if (++word >= area->numWords) return 0;
+			w = area->bitmap[word];
+		}
+		return word * INODE_MAPWORDBITS + __inodeFirstZero (w);
+	}
 	for (unsigned int a = startFrom; number == 0; a++) {
 		i = inodeLoad (a, d);
 		if (!i) break;
-		if (inodeGetBlockAddr(i, 0) == 0)
+		//I-node livre: sem tipo de arquivo e sem extents ou entradas
+		if (i->inodeItem[0] == 0 && inodeGetFileType(i) == 0)
 			number = inodeGetNumber(i);
-		free (i);
+		inodeRelease (i);
 	}
 	return number;
 }
+
+//Funcao que encontra um i-node livre em um disco, a partir do i-node de numero
+//startFrom. Retorna o numero do inode livre encontrado ou 0 se nao encontrado.
+//Com o mapa de i-nodes carregado, a busca examina uma palavra do mapa por vez,
+//sem acessos ao disco
+unsigned int inodeFindFreeInode (unsigned int startFrom, Disk *d) {
+	unsigned int ret;
+	__inodeLock ();
+	ret = __inodeFindFreeInode (startFrom, d);
+	__inodeUnlock ();
+	return ret;
+}
@@ -18,6 +18,18 @@
 //Tipo para representacao de i-nodes
 typedef struct inode Inode;
 
+//Cursor sobre o mapa de blocos de um i-node, para acesso sequencial. Mantem
+//em memoria a folha da arvore de extents e o extent do bloco corrente
+typedef struct inode_map {
+	Inode *inode;		//I-node do arquivo
+	unsigned int *leaf;	//Copia da folha da arvore de extents em uso
+	unsigned int block;	//Bloco logico corrente
+	unsigned int stride;	//Setores por bloco
+	unsigned int extStart;	//Primeiro bloco logico do extent corrente
+	unsigned int extAddr;	//Endereco do primeiro bloco do extent
+	unsigned int extLen;	//Numero de blocos do extent
+} InodeMap;
+
 //Funcao que retorna o numero de i-nodes por setor
 unsigned int inodeNumInodesPerSector ( void );
 
@@ -31,23 +43,48 @@ unsigned int inodeNumBlockAddresses ( void );
 //que deve ser unico no sistema de arquivos. Retorna ponteiro para o i-node
 //criado ou NULL se nao houver memoria suficiente ou number invalido. A funcao
 //salva o i-node em disco, com conteudo vazio e, portanto, o sobrescreve se ja 
-//existente
+//existente. O i-node deve ser liberado com inodeRelease
 Inode* inodeCreate (unsigned int number, Disk *d);
 
 //Funcao que limpa todo o conteudo de um i-node. O i-node e' salvo em disco,
-//sobrescrevendo-o se ja existente. Retorna 0 se bem sucedido ou -1, caso
+//sobrescrevendo-o se ja existente. Os blocos usados pela arvore de extents
+//sao devolvidos ao sistema de arquivos. Retorna 0 se bem sucedido ou -1, caso
 //contrario
 int inodeClear (Inode *i);
 
+//Funcao que limpa um i-node, como inodeClear, e o marca como livre no mapa de
+//i-nodes de seu disco. Os blocos de dados do arquivo devem ser devolvidos
+//antes ao sistema de arquivos. Retorna 0 se bem sucedido ou -1, caso
+//contrario
+int inodeFree (Inode *i);
+
 //Funcao que persiste um i-node em seu disco. Retorna 0 se gravacao bem sucedida
 //ou -1 caso contrario. I-nodes sao salvos a partir do setor 2. Numero de
-//i-nodes por setor pode variar de acordo com o tamanho do tipo unsigned int
+//i-nodes por setor pode variar de acordo com o tamanho do tipo unsigned int.
+//A gravacao e' adiada ate' o descarte do i-node da cache ou ate' inodeSync
 int inodeSave (Inode *i);
 
 //Funcao que recupera um i-node a partir do disco. Retorna ponteiro para o
-//i-node lido ou NULL em caso de falha.
+//i-node lido ou NULL em caso de falha. Cada i-node tem uma unica copia em
+//memoria (cache de i-nodes), compartilhada por todos que o carregam; a
+//referencia obtida deve ser liberada com inodeRelease
 Inode* inodeLoad (unsigned int number, Disk *d);
 
+//Funcao que libera uma referencia a um i-node obtida por inodeLoad ou
+//inodeCreate. O ponteiro nao deve ser usado apos a liberacao
+void inodeRelease (Inode *i);
+
+//Funcao que grava em seus setores os i-nodes alterados de um disco mantidos
+//na cache de i-nodes, ou de todos os discos se d for NULL. Deve preceder a
+//gravacao da cache de setores (cacheSync). Retorna 0 se bem sucedida e -1
+//caso contrario
+int inodeSync (Disk *d);
+
+//Funcao que descarta da cache os i-nodes sem referencias de um disco, sem
+//grava-los, e o mapa de i-nodes em uso do disco. Deve ser precedida por
+//inodeSync para que nao haja perda de dados
+void inodeInvalidate (Disk *d);
+
 //Funcao que modifica o tipo de arquivo referente a um i-node
 void inodeSetFileType (Inode *i, unsigned int fileType);
 
@@ -68,14 +105,23 @@ void inodeSetRefCount (Inode *i, unsigned int refCount);
 
 //Funcao que adiciona um endereco ao fim do array de blocos de um i-node
 //Retorna -1 caso a inclusao do endereco nao seja bem sucedida
-//E' a unica funcao que salva automaticamente o i-node em disco
+//E' a unica funcao que salva automaticamente o i-node em disco. Blocos
+//fisicamente contiguos sao descritos por um unico extent
 int inodeAddBlock (Inode *i, unsigned int blockAddr);
 
-//Funcao que retorna o numero de um i-node.
-unsigned int inodeGetNumber (Inode *i);
+//Funcao que remove do fim do array de blocos de um i-node os blocos a partir
+//do bloco numBlocks, mantendo os numBlocks primeiros. Os nos da arvore de
+//extents que ficam sem blocos sao devolvidos ao sistema de arquivos; os
+//blocos de dados removidos devem ser obtidos antes, por um cursor, e
+//devolvidos pelo proprio sistema de arquivos. Retorna 0 se bem sucedido ou
+//-1, caso contrario
+int inodeTruncate (Inode *i, unsigned int numBlocks);
+
+//Funcao que retorna o numero de blocos do array de blocos de um i-node
+unsigned int inodeGetNumBlocks (Inode *i);
 
 //Funcao que retorna o numero de um i-node.
-unsigned int inodeGetNextNumber (Inode *i);
+unsigned int inodeGetNumber (Inode *i);
 
 //Funcao que retorna o tipo de arquivo referente a um i-node.
 unsigned int inodeGetFileType (Inode *i);
@@ -96,12 +142,68 @@ unsigned int inodeGetPermission (Inode *i);
 unsigned int inodeGetRefCount (Inode *i);
 
 //Funcao que retorna o endereco correspondente a um bloco (blockNum) no array
-//de blocos de um i-node. O i-node precisa ser o primeiro de sua cadeia.
-//Retorna 0 se o bloco nao possuir endereco em blockNum
+//de blocos de um i-node. A raiz da arvore de extents fica no proprio i-node.
+//Retorna 0 se o bloco nao possuir endereco em blockNum. A busca na arvore de
+//extents le um bloco por nivel da arvore abaixo da raiz
 unsigned int inodeGetBlockAddr (Inode *i, unsigned int blockNum);
 
+//Funcao que informa o tamanho de bloco, em bytes, do sistema de arquivos de
+//um disco, usado para reconhecer blocos fisicamente contiguos
+void inodeSetBlockSize (Disk *d, unsigned int blockSize);
+
+//Funcao que informa as funcoes do sistema de arquivos de um disco para obter
+//(allocFn) e devolver (freeFn) blocos de dados. Arquivos fragmentados guardam
+//os nos de sua arvore de extents nesses blocos, e nao em i-nodes de extensao.
+//allocFn retorna o endereco de um bloco livre, de preferencia proximo ao bloco
+//goal, ou 0, e freeFn retorna 0 se bem sucedida
+void inodeSetAllocator (Disk *d,
+                        unsigned int (*allocFn)(Disk *d, unsigned int goal),
+                        int (*freeFn)(Disk *d, unsigned int blockAddr));
+
+//Funcao que inclui na tabela de i-nodes de um disco uma regiao de numInodes
+//i-nodes (multiplo de inodeNumInodesPerSector) a partir do setor startSector,
+//numerados apos os ja' existentes. Permite criar a tabela em partes e aumenta-la
+//com o sistema de arquivos em uso. Retorna 0 se bem sucedido ou -1 caso
+//contrario
+int inodeAddRegion (Disk *d, unsigned long startSector,
+                    unsigned int numInodes);
+
+//Funcao que carrega o mapa de i-nodes em uso de um disco, com capacidade para
+//maxInodes i-nodes, gravado a partir do setor bitmapSector. As regioes da
+//tabela devem ser informadas antes, por inodeAddRegion; sem elas, a tabela e'
+//uma unica regiao de maxInodes i-nodes. A partir de entao, i-nodes criados ou
+//liberados sao registrados no mapa, que e' gravado por inodeSync e descartado
+//por inodeInvalidate. Apenas os setores dos primeiros initInodes i-nodes
+//precisam estar iniciados: os demais sao tratados como vazios e iniciados
+//quando necessario. Retorna 0 se bem sucedido ou -1 caso contrario
+int inodeLoadBitmap (Disk *d, unsigned int maxInodes,
+                     unsigned long bitmapSector, unsigned int initInodes);
+
+//Funcao que retorna quantos i-nodes, a partir do primeiro, estao iniciados na
+//tabela de i-nodes de um disco. O valor cresce quando i-nodes em setores ainda
+//nao iniciados sao criados e deve ser registrado pelo sistema de arquivos
+unsigned int inodeGetInitCount (Disk *d);
+
+//Funcao que inicia um cursor (m) sobre o mapa de blocos de um i-node,
+//posicionado no bloco blockNum. O cursor deve ser encerrado com inodeMapEnd.
+//Retorna 0 se bem sucedido ou -1, caso contrario
+int inodeMapBegin (InodeMap *m, Inode *i, unsigned int blockNum);
+
+//Funcao que retorna o endereco do bloco corrente de um cursor, sem avanca-lo.
+//Retorna 0 se o bloco nao possuir endereco
+unsigned int inodeMapPeek (InodeMap *m);
+
+//Funcao que retorna o endereco do bloco corrente de um cursor e o avanca para
+//o bloco seguinte. Blocos incluidos com inodeAddBlock durante o uso do cursor
+//sao vistos por ele. Retorna 0 se o bloco nao possuir endereco
+unsigned int inodeMapNext (InodeMap *m);
+
+//Funcao que encerra um cursor, liberando a folha mantida em memoria
+void inodeMapEnd (InodeMap *m);
+
 //Funcao que encontra um i-node livre em um disco, a partir do i-node de numero
 //startFrom. Retorna o numero do inode livre encontrado ou 0 se nao encontrado.
+//O i-node so' passa a estar em uso quando criado por inodeCreate
 unsigned int inodeFindFreeInode (unsigned int startFrom, Disk *d);
 
 #endif
@@ -17,12 +17,15 @@
 #include "vfs.h"
 #include "inode.h"
 
-#define MAX_CONNECTEDDISKS 1
+#define MAX_CONNECTEDDISKS 4
 
 #define RESULT_MSGDELAY 1000
 
 #define NO_ID -1
 
+//Nomes das politicas de escalonamento de disco, indexados por DISK_SCHED_*
+const char *schedNames[] = { "FIFO", "SSTF", "C-LOOK" };
+
 //Tipo para manter dados sobre descritores de arquivos
 typedef struct fd {
 	int status; //Status do descritor de arquivos: 0 fechado, 1 aberto
@@ -33,32 +36,63 @@ typedef struct fd {
 Disk *disks[MAX_CONNECTEDDISKS]; //Discos conectados ao sistema
 unsigned int connectedDisks = 0; //Numero de discos conectados
 
+int diskBackend = DISK_BACKEND_STDIO; //Implementacao de E/S dos discos (-m)
+int virtualClock = 0;	//Relogio virtual: discos e mensagens sem atraso (-v)
+
 Disk *rd = NULL;	//Disco montado como sistema de arquivos raiz 
 int rfsid = NO_ID;	//ID do sistema de arquivo montado como raiz
 
 FD fds[MAX_FDS];	//Status, tipo e path dos descritores de arquivo
 unsigned int fdc = 0;	//Numero de descritores de arquivos abertos	
 
+//Pausa para leitura das mensagens de resultado. Suprimida no modo de
+//relogio virtual
+void resultDelay (void) {
+	if (!virtualClock) SLEEP (RESULT_MSGDELAY);
+}
+
 //Interface para contruir novo disco ou reconstruir disco existente (formatacao
 //de baixo nivel). Para construcao de novo disco, e' previsto que o disco nao
 //esteja conectado ao sistema hipotetico
 void doDiskBuild() {
 	char rawDiskPath[MAX_FILENAME_LENGTH+1];
-	unsigned long numCylinders;
+	char sizeSpec[MAX_FILENAME_LENGTH+1];
+	char *unit;
+	unsigned long numCylinders, sizeBytes = 0;
+	int ret;
 	printf ("\n>> Build: Raw disk file (e.g. 1024cyl.dsk): ");
 	scanf (" %s", rawDiskPath);
-	printf (">> Build: Number of cylinders (0: cancel): ");
-	scanf (" %lu", &numCylinders);
+	printf (">> Build: Number of cylinders or size with K/M/G suffix "
+	        "(e.g. 1024 or 2G; 0: cancel): ");
+	scanf (" %s", sizeSpec);
+	numCylinders = strtoul (sizeSpec, &unit, 10);
+	//Apenas digitos, seguidos ou nao de um unico sufixo K, M ou G
+	if ( unit == sizeSpec || sizeSpec[0] == '-'
+	     || (*unit && (unit[1] || !strchr ("KkMmGg", *unit))) ) {
+		printf ("\n!! Build: FAILED. Invalid size %s. Use a number of "
+		        "cylinders or a size with K/M/G suffix\n", sizeSpec);
+		resultDelay ();
+		return;
+	}
 	if (!numCylinders) return;
+	switch (*unit) {
+		case 'K': case 'k': sizeBytes = numCylinders << 10; break;
+		case 'M': case 'm': sizeBytes = numCylinders << 20; break;
+		case 'G': case 'g': sizeBytes = numCylinders << 30; break;
+	}
 	printf ("\n-- Building... "); fflush (stdout);
 
-	if ( diskCreateRawDisk (rawDiskPath, numCylinders) != -1 )
+	if (sizeBytes)
+		ret = diskCreateRawDiskSize (rawDiskPath, sizeBytes);
+	else
+		ret = diskCreateRawDisk (rawDiskPath, numCylinders);
+	if ( ret != -1 )
 		printf ("Disk %s successfully (re)built\n", rawDiskPath);
 	else
 		printf ("\n!! Build: FAILED. No permission or not enough "
 		        "free space\n");
 
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 
@@ -84,8 +118,9 @@ void doDiskConnect(char *rawDiskPath) {
 			scanf (" %s", rawDiskPath);
 		}
 		printf ("\n-- Connecting... "); fflush (stdout);
-		disks[id] = diskConnect (id, rawDiskPath);
+		disks[id] = diskConnectBackend (id, rawDiskPath, diskBackend);
 		if (disks[id]) {
+			diskSetVirtualClock (disks[id], virtualClock);
 			printf ("Disk %s successfully connected\n",
 			        rawDiskPath);
 			connectedDisks++;
@@ -98,7 +133,7 @@ void doDiskConnect(char *rawDiskPath) {
 			rawDiskPath = NULL;
 		}
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 //Interface para listar dados dos discos atualmente conectados ao sistema
@@ -109,13 +144,18 @@ void doDiskList (void) {
 	else {
 		printf ("\n-- DiskList: Listing...\n");
 		for (int id = 0; id<MAX_CONNECTEDDISKS; id++) {
+			if (!disks[id]) continue;
 			printf ("-- DiskID: %d; NumCylinders: %lu; "
-			        "DataSize: %lu\n",
+			        "DataSize: %lu; Scheduler: %s; "
+			        "SeekDistance: %lu; DiskTime: %lu ms\n",
 				id, diskGetNumCylinders(disks[id]),
-				diskGetSize(disks[id]));
+				diskGetSize(disks[id]),
+				schedNames[diskGetScheduler(disks[id])],
+				diskGetSeekDistance(disks[id]),
+				diskGetClock(disks[id]));
 		}
 	}
-	SLEEP(RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 //Interface para mostrar na saida padrao o conteudo de uma faixa de setores de
@@ -163,7 +203,38 @@ void doDiskReadPrintSectors (void) {
 			}
 		}
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
+}
+
+//Interface para escolher a politica de escalonamento de E/S de um disco
+//conectado ao sistema operacional hipotetico
+void doDiskScheduler (void) {
+	if ( !connectedDisks )
+		printf ("\n!! DiskScheduler: No connected disks!\n");
+	else {
+		int id, policy;
+		printf ("\n>> DiskScheduler: Disk ID: ");
+		scanf (" %u", &id);
+		if ( id > MAX_CONNECTEDDISKS - 1 || !disks[id])
+			printf ("\n!! DiskScheduler: FAILED. "
+			        "Invalid identifier!\n");
+		else {
+			printf (">> DiskScheduler: Policy (%d: %s, %d: %s, "
+			        "%d: %s): ", DISK_SCHED_FIFO,
+			        schedNames[DISK_SCHED_FIFO], DISK_SCHED_SSTF,
+			        schedNames[DISK_SCHED_SSTF], DISK_SCHED_CLOOK,
+			        schedNames[DISK_SCHED_CLOOK]);
+			scanf (" %d", &policy);
+			if ( diskSetScheduler (disks[id], policy) == 0 )
+				printf ("\n-- Disk %d now uses %s "
+				        "scheduling\n", id,
+				        schedNames[policy]);
+			else
+				printf ("\n!! DiskScheduler: FAILED. "
+				        "Invalid policy!\n");
+		}
+	}
+	resultDelay ();
 }
 
 //Interface para desconectar um disco do sistema operacional hipotetico
@@ -178,9 +249,9 @@ void doDiskDisconnect ( int id ) {
 		if ( id > MAX_CONNECTEDDISKS - 1 || !disks[id])
 			printf ("\n!! DiskDisconnect: FAILED. "
 			        "Invalid identifier!\n");
-		else if (disks[id] == rd) 
+		else if (vfsDiskIsMounted (disks[id]))
 			printf ("\n!! DiskDisconnect: FAILED. Cannot "
-			        "disconnect the root filesystem disk\n");
+			        "disconnect a mounted filesystem disk\n");
 		else {
 			printf ("\n-- Disconnecting... "); fflush (stdout);
 			if ( diskDisconnect (disks[id]) > -1 ) {
@@ -194,7 +265,7 @@ void doDiskDisconnect ( int id ) {
 				        "close the raw disk file!\n");
 		}
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 //Interface para formatar um disco conectado ao sistema operacional hipotetico,
@@ -210,9 +281,9 @@ void doFSFormat (void) {
 		if ( id > MAX_CONNECTEDDISKS - 1 || !disks[id])
 			printf ("\n!! DiskFormat: FAILED. "
 			        "Invalid identifier!\n");
-		else if (disks[id] == rd) 
+		else if (vfsDiskIsMounted (disks[id]))
 			printf ("\n!! DiskFormat: FAILED. "
-			        "Cannot format the root filesystem disk\n");
+			        "Cannot format a mounted filesystem disk\n");
 		else {
 			int fsid, bs;
 			printf (">> DiskFormat: Filesystem ID: ");
@@ -232,7 +303,7 @@ void doFSFormat (void) {
 				        "failed!\n");
 		}
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 //Interface para montar um disco conectado ao sistema operacional hipotetico,
@@ -267,7 +338,7 @@ void doFSMountRoot (void) {
 				        "failed!\n");
 		}
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 //Interface para mostrar os dados sobre descritores de arquivo em uso no
@@ -289,7 +360,7 @@ void doFSShowFDs (void) {
 				}
 		}
 	}
-	SLEEP(RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 
@@ -310,7 +381,75 @@ void doFSUnmountRoot (void) {
 			printf ("\n!! UnmountRoot: FAILED. Root file"
 				"system is busy or operation failed!\n");
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
+}
+
+//Interface para montar um disco conectado ao sistema operacional hipotetico
+//em um ponto de montagem (p.ex. /mnt/a) da arvore de diretorios
+void doFSMount (void) {
+	if ( !connectedDisks )
+		printf ("\n!! Mount: FAILED. No connected disks!\n");
+	else {
+		int id;
+		printf ("\n>> Mount: Disk ID: ");
+		scanf (" %u", &id);
+		if ( id > MAX_CONNECTEDDISKS - 1 || !disks[id])
+			printf ("\n!! Mount: FAILED. "
+			        "Invalid identifier!\n");
+		else {
+			int fsid;
+			char prefix[MAX_FILENAME_LENGTH+1];
+			printf (">> Mount: Filesystem ID: ");
+			scanf (" %u", &fsid);
+			printf (">> Mount: Mount point (e.g. /mnt/a): ");
+			scanf (" %s", prefix);
+			printf ("\n-- Mounting... "); fflush (stdout);
+			if ( vfsMount (disks[id], fsid, prefix) > -1 ) {
+				printf ("Disk %d successfully mounted at "
+				        "%s.\n", id, prefix);
+				if ( strcmp (prefix, "/") == 0 ) {
+					rd = disks[id];
+					rfsid = fsid;
+				}
+			}
+			else
+				printf ("\n!! Mount: FAILED. Filesystem not "
+				        "supported, mount point in use, no "
+				        "root filesystem or operation "
+				        "failed!\n");
+		}
+	}
+	resultDelay ();
+}
+
+//Interface para desmontar o sistema de arquivos de um ponto de montagem
+void doFSUnmount (void) {
+	char prefix[MAX_FILENAME_LENGTH+1];
+	printf ("\n>> Unmount: Mount point (e.g. /mnt/a): ");
+	scanf (" %s", prefix);
+	printf ("\n-- Unmounting... "); fflush (stdout);
+	if ( vfsUnmount (prefix) > -1 ) {
+		printf ("%s successfully unmounted.\n", prefix);
+		if ( strcmp (prefix, "/") == 0 ) {
+			rd = NULL;
+			rfsid = NO_ID;
+		}
+	}
+	else
+		printf ("\n!! Unmount: FAILED. Not a mount point, file"
+			"system is busy or operation failed!\n");
+	resultDelay ();
+}
+
+//Interface para gravar nos discos os dados pendentes de todos os sistemas de
+//arquivos montados
+void doFSSync (void) {
+	printf ("\n-- Syncing... "); fflush (stdout);
+	if ( vfsSync () > -1 )
+		printf ("All mounted filesystems successfully synced.\n");
+	else
+		printf ("\n!! Sync: FAILED. Cannot write to disk!\n");
+	resultDelay ();
 }
 
 //Interface para abrir um arquivo, criando-o se nao existir, em modo
@@ -341,7 +480,7 @@ void doFileOpen (void) {
 			printf ("\n!! FileOpen: FAILED. Invalid path or"
 				"no blocks/i-nodes available!\n");
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 //Interface para ler e imprimir bytes de um arquivo aberto
@@ -372,7 +511,7 @@ void doFileReadPrint (void) {
 			        "descriptor or i-node saving failure!\n");
 		free (buffer);
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 //Interface para escrever bytes de um arquivo aberto
@@ -404,7 +543,30 @@ void doFileWrite (void) {
 			        "descriptor or i-node saving failure!\n");
 		free (buffer);
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
+}
+
+//Interface para reduzir o tamanho de um arquivo aberto
+void doFileTruncate (void) {
+	if ( !rd )
+		printf ("\n!! FileTruncate: FAILED. No root filesystem "
+		        "mounted!\n");
+	else {
+		int fd;
+		unsigned int size;
+		printf ("\n>> FileTruncate: File descriptor (#): ");
+		scanf (" %u", &fd);
+		printf (">> FileTruncate: New size in bytes: ");
+		scanf (" %u", &size);
+		printf ("\n-- Truncating... "); fflush (stdout);
+		if ( vfsTruncate (fd, size) == 0 )
+			printf ("File %s successfully truncated to %u "
+			        "bytes.\n", fds[fd-1].path, size);
+		else
+			printf ("\n!! FileTruncate: FAILED. Invalid file "
+			        "descriptor or size larger than the file!\n");
+	}
+	resultDelay ();
 }
 
 //Interface para fechar um arquivo aberto
@@ -430,7 +592,7 @@ void doFileClose (int fd) {
 			printf ("\n!! FileClose: FAILED. Invalid file "
 			        "descriptor or i-node saving failure!\n");
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 //Interface para abrir um diretorio, criando-o se nao existir
@@ -460,7 +622,7 @@ void doDirOpen (void) {
 			printf ("\n!! DirOpen: FAILED. Invalid path or"
 				"no blocks/i-nodes available!\n");
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 //Interface para ler e listar entradas de um diretorio aberto
@@ -484,7 +646,7 @@ void doDirList (void) {
 			printf ("\n!! DirList: FAILED. Invalid file "
 			        "descriptor or i-node saving failure!\n");
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 //Interface para adicionar uma entrada (Link) em um diretorio aberto
@@ -511,7 +673,7 @@ void doDirLink (void) {
 			printf ("\n!! DirLink: FAILED. Invalid file "
 			        "descriptor or i-node!\n");
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 //Interface para remover uma entrada (Unlink) de um diretorio aberto
@@ -534,7 +696,7 @@ void doDirUnlink (void) {
 			printf ("\n!! DirUnlink: FAILED. Invalid file "
 			        "descriptor or entry name!\n");
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 
@@ -561,7 +723,7 @@ void doDirClose (int fd) {
 			printf ("\n!! DirClose: FAILED. Invalid file "
 			        "descriptor or i-node saving failure!\n");
 	}
-	SLEEP (RESULT_MSGDELAY);
+	resultDelay ();
 }
 
 
@@ -577,7 +739,9 @@ char sanitizeBeforeQuit () {
 					doFileClose(a);
 				else doDirClose(a);
 			}
-	//Desmontando a raiz do sistema de arquivos
+	//Desmontando os demais pontos de montagem e a raiz do sistema de
+	//arquivos
+	vfsUnmountAll ();
 	if (rd) doFSUnmountRoot();
 
 	//Desconectando discos
@@ -626,6 +790,7 @@ void fileMenuSelection (void) {
 			  "     [O]pen file\n"
 		          "     [R]ead bytes from file\n"
 		          "     [W]rite bytes to file\n"
+		          "     [T]runcate file\n"
 			  "     [C]lose file\n"
 		          "     [<]back to MAIN menu\n"
 		          "\n>> Your selection: ", connectedDisks,
@@ -635,6 +800,7 @@ void fileMenuSelection (void) {
 			case 'O': case 'o': doFileOpen(); break;
 			case 'R': case 'r': doFileReadPrint(); break;
 			case 'W': case 'w': doFileWrite(); break;
+			case 'T': case 't': doFileTruncate(); break;
 			case 'C': case 'c': doFileClose(NO_ID); break;
 		}
 	}
@@ -648,22 +814,36 @@ void fsMenuSelection (void) {
 		printf ("\nFILESYSTEM management:                  "
 			  "               Disks: %u / Root Disk: %d\n"
 			  "     [L]ist supported filesystems\n"
+			  "     [I]/O statistics of mounted disks\n"
 		          "     [F]ormat a disk (high-level format)\n"
 		          "     [M]ount root filesystem\n"
 		          "     [S]how file descriptors in use\n"
 			  "     [U]mount root filesystem\n"
+		          "     [A]ttach a disk at a mount point\n"
+		          "     [D]etach a mount point\n"
+		          "     [T]able of mount points\n"
+		          "    s[Y]nc mounted filesystems\n"
 		          "     [<]back to MAIN menu\n"
 		          "\n>> Your selection: ", connectedDisks,
 			  (rd ? diskGetId(rd) : -1));
 		scanf (" %c", &choice);
 		switch (choice) {
 			case 'L': case 'l': vfsDumpFSInfo();
-			                    SLEEP(RESULT_MSGDELAY);
+			                    resultDelay ();
+					    break;
+			case 'I': case 'i': vfsDumpDiskStats();
+			                    resultDelay ();
 					    break;
 			case 'F': case 'f': doFSFormat(); break;
 			case 'M': case 'm': doFSMountRoot(); break;
 			case 'S': case 's': doFSShowFDs(); break;
 			case 'U': case 'u': doFSUnmountRoot(); break;
+			case 'A': case 'a': doFSMount(); break;
+			case 'D': case 'd': doFSUnmount(); break;
+			case 'T': case 't': vfsDumpMounts();
+			                    resultDelay ();
+					    break;
+			case 'Y': case 'y': doFSSync(); break;
 		}
 	}
 }
@@ -678,6 +858,7 @@ void diskMenuSelection (void) {
 		          "     [C]onnect a disk\n"
 			  "     [L]ist connected disks\n"
 			  "     [R]ead/print sector range from a disk\n"
+			  "     [S]elect I/O scheduler policy of a disk\n"
 		          "     [D]isconnect a disk\n"
 		          "     [<]back to MAIN menu\n"
 		          "\n>> Your selection: ", connectedDisks,
@@ -689,6 +870,7 @@ void diskMenuSelection (void) {
 			case 'C': case 'c': doDiskConnect(NULL); break;
 			case 'L': case 'l': doDiskList(); break;
 			case 'R': case 'r': doDiskReadPrintSectors(); break;
+			case 'S': case 's': doDiskScheduler(); break;
 			case 'D': case 'd': doDiskDisconnect(NO_ID); break;
 		}
 	}
@@ -732,8 +914,16 @@ int main (int argc, char* argv[]) {
 		strcpy (fds[a-1].path, "");
 	}
 
-	if (argc > 1) 
-		doDiskConnect (argv[1]);
+	//Opcoes: -m conecta os discos com arquivo mapeado em memoria (mmap)
+	//          -v usa relogio virtual, sem dormir nos atrasos simulados
+	for (int a=1; a<argc; a++) {
+		if (strcmp (argv[a], "-m") == 0)
+			diskBackend = DISK_BACKEND_MMAP;
+		else if (strcmp (argv[a], "-v") == 0)
+			virtualClock = 1;
+		else
+			doDiskConnect (argv[a]);
+	}
 
 	mainMenuSelection();
 
@@ -11,14 +11,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
 #include "myfs.h"
 #include "vfs.h"
 #include "inode.h"
+#include "cache.h"
 #include "util.h"
 
 #define MYFS_MAGIC 0x4D594653
 #define INODE_BEGINSECTOR 2
+#define INODE_REGIONSECTOR 1
 #define INODE_SIZE 16
+#define MYFS_MAXBATCHBLOCKS 32
+#define MYFS_MAX_VOLUMES 8
+#define MYFS_READAHEAD_MINBLOCKS 4
+#define MYFS_READAHEAD_MAXSECTORS (CACHE_NUMENTRIES / 2)
+#define MYFS_BYTES_PER_INODE 4096
+#define MYFS_MAX_INODEREGIONS (DISK_SECTORDATASIZE / 8)
+#define MYFS_SUPERBLOCK_FIELDS 14
+#define MYFS_MAPWORDBITS 64
+#define MYFS_MAPSECTORWORDS (DISK_SECTORDATASIZE / 8)
+#define MYFS_FLUSH_INTERVALMS 500
+#define MYFS_FLUSH_MAXDIRTY 64
+#define MYFS_RECLAIM_BATCHBLOCKS 256
+#define MYFS_MAX_AIOS 16
 
 typedef struct
 {
@@ -30,421 +47,2050 @@ typedef struct
 	unsigned int dataBlockStart;
 	unsigned int freeBlockList;
 	unsigned int rootInode;
+	unsigned int inodeBitmapStart;
+	unsigned int inodeTableInit;
+	unsigned int maxInodes;
+	unsigned int numInodeRegions;
+	unsigned int blockBitmapStart;
+	unsigned int blockBitmapInit;
 } superblock;
 
-superblock sb;
+typedef struct
+{
+	char path[MAX_FILENAME_LENGTH + 1];
+	unsigned int inodeNum;
+} FileEntry;
+
+typedef struct
+{
+	unsigned int start;
+	unsigned int numInodes;
+} InodeRegionEntry;
+
+typedef struct
+{
+	unsigned int addr;
+	unsigned int count;
+} BlockRun;
+
+typedef struct
+{
+	int used;
+	Disk *disk;
+	superblock sb;
+	InodeRegionEntry inodeRegions[MYFS_MAX_INODEREGIONS];
+	unsigned long long *blockMap;
+	unsigned int blockMapWords;
+	unsigned int blockHint;
+	unsigned int blockMapDirtyLo;
+	unsigned int blockMapDirtyHi;
+	unsigned int freeBlocks;
+	int sbDirty;
+	unsigned long lastFlush;
+	unsigned int dirtyUpdates;
+	unsigned int *reclaimQueue;
+	unsigned int numReclaim;
+	unsigned int reclaimSize;
+	pthread_t reclaimer;
+	pthread_cond_t reclaimWake;
+	int reclaimerRunning;
+	int stopReclaim;
+	FileEntry *fileTable;
+	unsigned int numFileEntries;
+	unsigned int fileTableSize;
+} Volume;
+
+static Volume volumes[MYFS_MAX_VOLUMES];
 
 typedef struct
 {
 	int used;
+	int isDir;
 	Disk *disk;
+	Volume *volume;
 	unsigned int inodeNum;
 	unsigned int cursor;
 	Inode *inode;
+	unsigned int lastReadEnd;
+	unsigned int raWindow;
+	unsigned int raNext;
 } FileDescriptor;
 
 static FileDescriptor fdTable[MAX_FDS];
 
-#define MAX_FILE_ENTRIES 128
 typedef struct
 {
-	char path[MAX_FILENAME_LENGTH + 1];
-	unsigned int inodeNum;
-} FileEntry;
-
-static FileEntry fileTable[MAX_FILE_ENTRIES];
-
-static int findFileEntry(const char *path)
+	int used;
+	int fd;
+	int write;
+	char *buf;
+	unsigned char *data;
+	unsigned int offset;
+	unsigned int nbytes;
+	DiskIO *ios;
+	unsigned int numIOs;
+	unsigned int pending;
+	int status;
+} AsyncRequest;
+
+static AsyncRequest aioTable[MYFS_MAX_AIOS];
+static pthread_mutex_t aioLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aioDone = PTHREAD_COND_INITIALIZER;
+
+// Lock order: mountLock, then a volume lock, then the inode and cache locks.
+// volumesLock and fdLock only guard slot lookups and are never held across
+// other calls.
+static pthread_mutex_t mountLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t volumesLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t fdLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t volumeLocks[MYFS_MAX_VOLUMES];
+static pthread_once_t volumeLocksOnce = PTHREAD_ONCE_INIT;
+
+static Volume *findVolume(Disk *d)
 {
-	for (int i = 0; i < MAX_FILE_ENTRIES; i++)
+	Volume *vol = NULL;
+	pthread_mutex_lock(&volumesLock);
+	for (int i = 0; i < MYFS_MAX_VOLUMES; i++)
 	{
-		if (fileTable[i].inodeNum != 0 && strcmp(fileTable[i].path, path) == 0)
+		if (volumes[i].used && volumes[i].disk == d)
 		{
-			return i;
+			vol = &volumes[i];
+			break;
 		}
 	}
-	return -1;
+	pthread_mutex_unlock(&volumesLock);
+	return vol;
 }
 
-static int addFileEntry(const char *path, unsigned int inodeNum)
+static void initVolumeLocks(void)
 {
-	for (int i = 0; i < MAX_FILE_ENTRIES; i++)
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	for (int i = 0; i < MYFS_MAX_VOLUMES; i++)
 	{
-		if (fileTable[i].inodeNum == 0)
-		{
-			fileTable[i].inodeNum = inodeNum;
-			strncpy(fileTable[i].path, path, MAX_FILENAME_LENGTH);
-			fileTable[i].path[MAX_FILENAME_LENGTH] = '\0';
-			return i;
-		}
+		pthread_mutex_init(&volumeLocks[i], &attr);
 	}
-	return -1;
+	pthread_mutexattr_destroy(&attr);
 }
 
-int myFSIsIdle(Disk *d)
+static void lockVolume(Volume *vol)
 {
-	for (int i = 0; i < MAX_FDS; i++)
+	pthread_once(&volumeLocksOnce, initVolumeLocks);
+	pthread_mutex_lock(&volumeLocks[vol - volumes]);
+}
+
+static void unlockVolume(Volume *vol)
+{
+	pthread_mutex_unlock(&volumeLocks[vol - volumes]);
+}
+
+static Volume *lockVolumeOf(Disk *d)
+{
+	Volume *vol = findVolume(d);
+	if (vol == NULL)
 	{
-		if (fdTable[i].used && fdTable[i].disk == d)
-		{
-			return 0;
-		}
+		return NULL;
 	}
-	return 1;
+
+	lockVolume(vol);
+	if (findVolume(d) != vol)
+	{
+		unlockVolume(vol);
+		return NULL;
+	}
+	return vol;
 }
 
-static unsigned int allocateFreeBlock(Disk *d)
+static Volume *lockDescriptor(int fd)
 {
-	if (d == NULL || sb.magic != MYFS_MAGIC)
+	int idx = fd - 1;
+	if (idx < 0 || idx >= MAX_FDS)
 	{
-		return 0;
+		return NULL;
 	}
 
-	if (sb.freeBlockList == 0)
+	pthread_mutex_lock(&fdLock);
+	Volume *vol = fdTable[idx].used ? fdTable[idx].volume : NULL;
+	pthread_mutex_unlock(&fdLock);
+	if (vol == NULL)
 	{
-		return 0;
+		return NULL;
 	}
 
-	unsigned int freeBlock = sb.freeBlockList;
+	lockVolume(vol);
+	pthread_mutex_lock(&fdLock);
+	int valid = fdTable[idx].used && fdTable[idx].volume == vol;
+	pthread_mutex_unlock(&fdLock);
+	if (!valid)
+	{
+		unlockVolume(vol);
+		return NULL;
+	}
+	return vol;
+}
 
-	unsigned char buffer[DISK_SECTORDATASIZE];
-	if (diskReadSector(d, freeBlock, buffer) != 0)
+static int allocDescriptor(Volume *vol, int isDir)
+{
+	int idx = -1;
+	pthread_mutex_lock(&fdLock);
+	for (int i = 0; i < MAX_FDS; i++)
 	{
-		return 0;
+		if (!fdTable[i].used)
+		{
+			memset(&fdTable[i], 0, sizeof(FileDescriptor));
+			fdTable[i].used = 1;
+			fdTable[i].isDir = isDir;
+			fdTable[i].disk = vol->disk;
+			fdTable[i].volume = vol;
+			idx = i;
+			break;
+		}
 	}
+	pthread_mutex_unlock(&fdLock);
+	return idx;
+}
 
-	unsigned int nextFree;
-	char2ul(buffer, &nextFree);
+static void releaseDescriptor(int idx)
+{
+	pthread_mutex_lock(&fdLock);
+	memset(&fdTable[idx], 0, sizeof(FileDescriptor));
+	pthread_mutex_unlock(&fdLock);
+}
 
-	sb.freeBlockList = nextFree;
+static int findFileEntry(Volume *vol, const char *path)
+{
+	for (unsigned int i = 0; i < vol->numFileEntries; i++)
+	{
+		if (strcmp(vol->fileTable[i].path, path) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
 
-	unsigned char sbBuffer[DISK_SECTORDATASIZE];
-	ul2char(sb.magic, &sbBuffer[0]);
-	ul2char(sb.blockSize, &sbBuffer[4]);
-	ul2char(sb.numBlocks, &sbBuffer[8]);
-	ul2char(sb.numInodes, &sbBuffer[12]);
-	ul2char(sb.inodeTableStart, &sbBuffer[16]);
-	ul2char(sb.dataBlockStart, &sbBuffer[20]);
-	ul2char(sb.freeBlockList, &sbBuffer[24]);
-	ul2char(sb.rootInode, &sbBuffer[28]);
-	for (int i = 32; i < DISK_SECTORDATASIZE; i++)
+static int addFileEntry(Volume *vol, const char *path, unsigned int inodeNum)
+{
+	if (vol->numFileEntries == vol->fileTableSize)
 	{
-		sbBuffer[i] = 0;
+		unsigned int newSize = vol->fileTableSize ? vol->fileTableSize * 2 : 64;
+		FileEntry *newTable = realloc(vol->fileTable, newSize * sizeof(FileEntry));
+		if (newTable == NULL)
+		{
+			return -1;
+		}
+		vol->fileTable = newTable;
+		vol->fileTableSize = newSize;
 	}
-	diskWriteSector(d, 0, sbBuffer);
 
-	return freeBlock;
+	int i = vol->numFileEntries++;
+	vol->fileTable[i].inodeNum = inodeNum;
+	strncpy(vol->fileTable[i].path, path, MAX_FILENAME_LENGTH);
+	vol->fileTable[i].path[MAX_FILENAME_LENGTH] = '\0';
+	return i;
 }
 
-int myFSFormat(Disk *d, unsigned int blockSize)
+static void encodeSuperblock(const superblock *sb, unsigned char *buffer)
 {
-	if (d == NULL || blockSize == 0 || blockSize % DISK_SECTORDATASIZE != 0)
+	unsigned int fields[MYFS_SUPERBLOCK_FIELDS] = {
+		sb->magic, sb->blockSize, sb->numBlocks, sb->numInodes,
+		sb->inodeTableStart, sb->dataBlockStart, sb->freeBlockList, sb->rootInode,
+		sb->inodeBitmapStart, sb->inodeTableInit, sb->maxInodes, sb->numInodeRegions,
+		sb->blockBitmapStart, sb->blockBitmapInit};
+	ul2charArray(fields, MYFS_SUPERBLOCK_FIELDS, buffer);
+}
+
+static void decodeSuperblock(const unsigned char *buffer, superblock *sb)
+{
+	unsigned int fields[MYFS_SUPERBLOCK_FIELDS];
+	char2ulArray(buffer, MYFS_SUPERBLOCK_FIELDS, fields);
+	sb->magic = fields[0];
+	sb->blockSize = fields[1];
+	sb->numBlocks = fields[2];
+	sb->numInodes = fields[3];
+	sb->inodeTableStart = fields[4];
+	sb->dataBlockStart = fields[5];
+	sb->freeBlockList = fields[6];
+	sb->rootInode = fields[7];
+	sb->inodeBitmapStart = fields[8];
+	sb->inodeTableInit = fields[9];
+	sb->maxInodes = fields[10];
+	sb->numInodeRegions = fields[11];
+	sb->blockBitmapStart = fields[12];
+	sb->blockBitmapInit = fields[13];
+}
+
+static int saveSuperblock(Volume *vol)
+{
+	unsigned char buffer[DISK_SECTORDATASIZE];
+	memset(buffer, 0, sizeof(buffer));
+	encodeSuperblock(&vol->sb, buffer);
+	if (cacheWriteSector(vol->disk, 0, buffer) != 0)
 	{
 		return -1;
 	}
+	vol->sbDirty = 0;
+	return 0;
+}
 
-	unsigned long numSectors = diskGetNumSectors(d);
-	unsigned int numInodes = 128;
-	unsigned int inodesPerSector = inodeNumInodesPerSector();
-	unsigned int inodeSectors = (numInodes + inodesPerSector - 1) / inodesPerSector;
-	unsigned int inodeTableStart = 2;
-	unsigned int sectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
-	unsigned int dataBlockStart = inodeTableStart + inodeSectors;
-	unsigned int dataAreaSectors = numSectors - dataBlockStart;
-	unsigned int numBlocks = dataAreaSectors / sectorsPerBlock;
+static int flushSuperblock(Volume *vol)
+{
+	return vol->sbDirty ? saveSuperblock(vol) : 0;
+}
 
-	sb.magic = MYFS_MAGIC;
-	sb.blockSize = blockSize;
-	sb.numBlocks = numBlocks;
-	sb.numInodes = numInodes;
-	sb.inodeTableStart = inodeTableStart;
-	sb.dataBlockStart = dataBlockStart;
-	sb.freeBlockList = 0;
-	sb.rootInode = 1;
+int myFSIsIdle(Disk *d)
+{
+	int idle = 1;
+	pthread_mutex_lock(&fdLock);
+	for (int i = 0; i < MAX_FDS; i++)
+	{
+		if (fdTable[i].used && fdTable[i].disk == d)
+		{
+			idle = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fdLock);
+	return idle;
+}
 
+static int saveInodeRegions(Volume *vol)
+{
 	unsigned char buffer[DISK_SECTORDATASIZE];
-	ul2char(sb.magic, &buffer[0]);
-	ul2char(sb.blockSize, &buffer[4]);
-	ul2char(sb.numBlocks, &buffer[8]);
-	ul2char(sb.numInodes, &buffer[12]);
-	ul2char(sb.inodeTableStart, &buffer[16]);
-	ul2char(sb.dataBlockStart, &buffer[20]);
-	ul2char(sb.freeBlockList, &buffer[24]);
-	ul2char(sb.rootInode, &buffer[28]);
+	unsigned int fields[MYFS_MAX_INODEREGIONS * 2];
+	memset(buffer, 0, sizeof(buffer));
+	for (unsigned int i = 0; i < vol->sb.numInodeRegions; i++)
+	{
+		fields[i * 2] = vol->inodeRegions[i].start;
+		fields[i * 2 + 1] = vol->inodeRegions[i].numInodes;
+	}
+	ul2charArray(fields, vol->sb.numInodeRegions * 2, buffer);
+	return cacheWriteSector(vol->disk, INODE_REGIONSECTOR, buffer);
+}
 
-	for (int i = 32; i < DISK_SECTORDATASIZE; i++)
+static int loadInodeRegions(Volume *vol)
+{
+	if (vol->sb.numInodeRegions == 0)
 	{
-		buffer[i] = 0;
+		return inodeAddRegion(vol->disk, vol->sb.inodeTableStart, vol->sb.numInodes);
 	}
 
-	if (diskWriteSector(d, 0, buffer) != 0)
+	unsigned char buffer[DISK_SECTORDATASIZE];
+	if (vol->sb.numInodeRegions > MYFS_MAX_INODEREGIONS ||
+	    cacheReadSector(vol->disk, INODE_REGIONSECTOR, buffer) != 0)
 	{
 		return -1;
 	}
 
-	unsigned char zeroBuffer[DISK_SECTORDATASIZE];
-	memset(zeroBuffer, 0, DISK_SECTORDATASIZE);
-
-	for (unsigned int i = 0; i < inodeSectors; i++)
+	unsigned int fields[MYFS_MAX_INODEREGIONS * 2];
+	char2ulArray(buffer, vol->sb.numInodeRegions * 2, fields);
+	for (unsigned int i = 0; i < vol->sb.numInodeRegions; i++)
 	{
-		if (diskWriteSector(d, inodeTableStart + i, zeroBuffer) != 0)
+		vol->inodeRegions[i].start = fields[i * 2];
+		vol->inodeRegions[i].numInodes = fields[i * 2 + 1];
+		if (inodeAddRegion(vol->disk, vol->inodeRegions[i].start, vol->inodeRegions[i].numInodes) != 0)
 		{
 			return -1;
 		}
 	}
+	return 0;
+}
 
-	unsigned char blockBuffer[DISK_SECTORDATASIZE];
-	memset(blockBuffer, 0, DISK_SECTORDATASIZE);
-
-	for (unsigned int i = 0; i < numBlocks; i++)
+static int updateInodeTableInit(Volume *vol)
+{
+	unsigned int initInodes = inodeGetInitCount(vol->disk);
+	if (initInodes == vol->sb.inodeTableInit)
 	{
-		unsigned int currentBlockSector = dataBlockStart + (i * sectorsPerBlock);
-		unsigned int nextBlockSector;
+		return 0;
+	}
 
-		if (i < numBlocks - 1)
-		{
-			nextBlockSector = dataBlockStart + ((i + 1) * sectorsPerBlock);
-		}
-		else
-		{
-			nextBlockSector = 0;
-		}
+	vol->sb.inodeTableInit = initInodes;
+	vol->sbDirty = 1;
+	return 0;
+}
 
-		ul2char(nextBlockSector, blockBuffer);
+static unsigned int blockMapSectors(unsigned int numBlocks)
+{
+	return (numBlocks + DISK_SECTORDATASIZE * 8 - 1) / (DISK_SECTORDATASIZE * 8);
+}
 
-		if (diskWriteSector(d, currentBlockSector, blockBuffer) != 0)
-		{
-			return -1;
-		}
+static int firstZeroBit(unsigned long long w)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(~w);
+#else
+	int bit = 0;
+	while (w & 1)
+	{
+		w >>= 1;
+		bit++;
 	}
+	return bit;
+#endif
+}
 
-	sb.freeBlockList = dataBlockStart;
+static int countSetBits(unsigned long long w)
+{
+#ifdef __GNUC__
+	return __builtin_popcountll(w);
+#else
+	int bits = 0;
+	for (; w != 0; w &= w - 1)
+	{
+		bits++;
+	}
+	return bits;
+#endif
+}
 
-	ul2char(sb.magic, &buffer[0]);
-	ul2char(sb.blockSize, &buffer[4]);
-	ul2char(sb.numBlocks, &buffer[8]);
-	ul2char(sb.numInodes, &buffer[12]);
-	ul2char(sb.inodeTableStart, &buffer[16]);
-	ul2char(sb.dataBlockStart, &buffer[20]);
-	ul2char(sb.freeBlockList, &buffer[24]);
-	ul2char(sb.rootInode, &buffer[28]);
+static void markBlockMapDirty(Volume *vol, unsigned int word)
+{
+	vol->dirtyUpdates++;
+	if (vol->blockMapDirtyLo > vol->blockMapDirtyHi)
+	{
+		vol->blockMapDirtyLo = word;
+		vol->blockMapDirtyHi = word;
+	}
+	else if (word < vol->blockMapDirtyLo)
+	{
+		vol->blockMapDirtyLo = word;
+	}
+	else if (word > vol->blockMapDirtyHi)
+	{
+		vol->blockMapDirtyHi = word;
+	}
+}
 
-	if (diskWriteSector(d, 0, buffer) != 0)
+static int createBlockMap(Volume *vol)
+{
+	unsigned int numWords = blockMapSectors(vol->sb.numBlocks) * MYFS_MAPSECTORWORDS;
+	vol->blockMap = calloc(numWords, sizeof(unsigned long long));
+	if (vol->blockMap == NULL)
 	{
 		return -1;
 	}
 
-	for (unsigned int inodeNum = 1; inodeNum <= numInodes; inodeNum++)
+	vol->blockMapWords = numWords;
+	vol->blockHint = 0;
+	vol->freeBlocks = vol->sb.numBlocks;
+	vol->blockMapDirtyLo = 1;
+	vol->blockMapDirtyHi = 0;
+	for (unsigned int b = vol->sb.numBlocks; b < numWords * MYFS_MAPWORDBITS; b++)
 	{
-		Inode *tmp = inodeCreate(inodeNum, d);
-		if (tmp == NULL)
-		{
-			return -1;
-		}
-		free(tmp);
+		vol->blockMap[b / MYFS_MAPWORDBITS] |= 1ULL << (b % MYFS_MAPWORDBITS);
 	}
+	return 0;
+}
 
-	Inode *rootInode = inodeLoad(1, d);
-	if (rootInode == NULL)
+static int loadBlockMap(Volume *vol)
+{
+	if (vol->sb.blockBitmapStart == 0)
 	{
-		return -1;
+		return 0;
 	}
 
-	unsigned int rootBlock = allocateFreeBlock(d);
-	if (rootBlock == 0)
+	if (createBlockMap(vol) != 0)
 	{
-		free(rootInode);
 		return -1;
 	}
 
-	if (inodeAddBlock(rootInode, rootBlock) != 0)
+	unsigned int numSectors = blockMapSectors(vol->sb.numBlocks);
+	if (vol->sb.blockBitmapInit < numSectors)
 	{
-		free(rootInode);
-		return -1;
+		numSectors = vol->sb.blockBitmapInit;
+	}
+	unsigned int numWords = numSectors * MYFS_MAPSECTORWORDS;
+	if (numSectors == 0)
+	{
+		return 0;
 	}
 
-	inodeSetFileType(rootInode, FILETYPE_DIR);
-	inodeSetFileSize(rootInode, 0);
-	inodeSetOwner(rootInode, 0);
-	inodeSetGroupOwner(rootInode, 0);
-	inodeSetPermission(rootInode, 0755);
-
-	if (inodeSave(rootInode) != 0)
+	unsigned char *buffer = malloc(numSectors * DISK_SECTORDATASIZE);
+	if (buffer == NULL || cacheReadSectors(vol->disk, vol->sb.blockBitmapStart, numSectors, buffer) != 0)
 	{
-		free(rootInode);
+		free(buffer);
 		return -1;
 	}
 
-	free(rootInode);
-
-	return numBlocks;
+	unsigned long long *onDisk = malloc(numWords * sizeof(unsigned long long));
+	if (onDisk == NULL)
+	{
+		free(buffer);
+		return -1;
+	}
+	char2ullArray(buffer, numWords, onDisk);
+	for (unsigned int w = 0; w < numWords; w++)
+	{
+		vol->freeBlocks -= countSetBits(~vol->blockMap[w] & onDisk[w]);
+		vol->blockMap[w] |= onDisk[w];
+	}
+	free(onDisk);
+	free(buffer);
+	return 0;
 }
 
-int myFSxMount(Disk *d, int x)
+static int saveBlockMap(Volume *vol)
 {
-	if (d == NULL)
+	if (vol->blockMap == NULL || vol->blockMapDirtyLo > vol->blockMapDirtyHi)
 	{
 		return 0;
 	}
 
-	if (x == 1)
+	unsigned int firstSector = vol->blockMapDirtyLo / MYFS_MAPSECTORWORDS;
+	unsigned int lastSector = vol->blockMapDirtyHi / MYFS_MAPSECTORWORDS;
+	if (lastSector >= vol->sb.blockBitmapInit)
 	{
-		unsigned char buffer[DISK_SECTORDATASIZE];
-		if (diskReadSector(d, 0, buffer) != 0)
-		{
-			return 0;
-		}
-
-		char2ul(&buffer[0], &sb.magic);
-		char2ul(&buffer[4], &sb.blockSize);
-		char2ul(&buffer[8], &sb.numBlocks);
-		char2ul(&buffer[12], &sb.numInodes);
-		char2ul(&buffer[16], &sb.inodeTableStart);
-		char2ul(&buffer[20], &sb.dataBlockStart);
-		char2ul(&buffer[24], &sb.freeBlockList);
-		char2ul(&buffer[28], &sb.rootInode);
-
-		if (sb.magic != MYFS_MAGIC)
-		{
-			return 0;
-		}
-
-		if (sb.blockSize == 0 || sb.blockSize % DISK_SECTORDATASIZE != 0)
+		if (firstSector > vol->sb.blockBitmapInit)
 		{
-			return 0;
+			firstSector = vol->sb.blockBitmapInit;
 		}
+		vol->sb.blockBitmapInit = lastSector + 1;
+		vol->sbDirty = 1;
+	}
+	unsigned int numSectors = lastSector - firstSector + 1;
+	unsigned char *buffer = malloc(numSectors * DISK_SECTORDATASIZE);
+	if (buffer == NULL)
+	{
+		return -1;
+	}
 
-		if (sb.numBlocks == 0 || sb.numInodes == 0)
-		{
-			return 0;
-		}
+	ull2charArray(vol->blockMap + firstSector * MYFS_MAPSECTORWORDS, numSectors * MYFS_MAPSECTORWORDS, buffer);
+	int ret = cacheWriteSectors(vol->disk, vol->sb.blockBitmapStart + firstSector, numSectors, buffer);
+	free(buffer);
+	if (ret == 0)
+	{
+		vol->blockMapDirtyLo = 1;
+		vol->blockMapDirtyHi = 0;
+	}
+	return ret;
+}
 
-		memset(fdTable, 0, sizeof(fdTable));
-		memset(fileTable, 0, sizeof(fileTable));
+static unsigned int goalBlockIndex(Volume *vol, unsigned int goal)
+{
+	unsigned int start = vol->blockHint;
+	if (goal >= vol->sb.dataBlockStart)
+	{
+		start = (goal - vol->sb.dataBlockStart) / (vol->sb.blockSize / DISK_SECTORDATASIZE);
+	}
+	if (start >= vol->sb.numBlocks)
+	{
+		start = 0;
+	}
+	return start;
+}
 
-		return 1;
+static unsigned int allocateFreeBlockNear(Volume *vol, unsigned int goal)
+{
+	if (vol == NULL || vol->sb.magic != MYFS_MAGIC)
+	{
+		return 0;
 	}
 
-	if (x == 0)
+	unsigned int sectorsPerBlock = vol->sb.blockSize / DISK_SECTORDATASIZE;
+	if (vol->blockMap != NULL)
 	{
-		if (!myFSIsIdle(d))
+		if (vol->freeBlocks == 0)
 		{
 			return 0;
 		}
 
-		for (int i = 0; i < MAX_FDS; i++)
+		unsigned int start = goalBlockIndex(vol, goal);
+
+		unsigned int word = start / MYFS_MAPWORDBITS;
+		unsigned long long below = (1ULL << (start % MYFS_MAPWORDBITS)) - 1;
+		unsigned long long w = vol->blockMap[word] | below;
+		for (unsigned int n = 0; n <= vol->blockMapWords; n++)
 		{
-			if (fdTable[i].disk == d)
+			if (w != ~0ULL)
 			{
-				fdTable[i].used = 0;
-				fdTable[i].disk = NULL;
-				fdTable[i].inodeNum = 0;
-				fdTable[i].cursor = 0;
-				if (fdTable[i].inode != NULL)
-				{
-					free(fdTable[i].inode);
-					fdTable[i].inode = NULL;
-				}
+				unsigned int b = word * MYFS_MAPWORDBITS + firstZeroBit(w);
+				vol->blockMap[word] |= 1ULL << (b % MYFS_MAPWORDBITS);
+				markBlockMapDirty(vol, word);
+				vol->freeBlocks--;
+				vol->blockHint = b + 1 < vol->sb.numBlocks ? b + 1 : 0;
+				return vol->sb.dataBlockStart + b * sectorsPerBlock;
 			}
+			word = (word + 1) % vol->blockMapWords;
+			w = vol->blockMap[word];
 		}
+		return 0;
+	}
+
+	if (vol->sb.freeBlockList == 0)
+	{
+		return 0;
+	}
 
-		memset(&sb, 0, sizeof(sb));
+	unsigned int freeBlock = vol->sb.freeBlockList;
 
-		return 1;
+	unsigned char buffer[DISK_SECTORDATASIZE];
+	if (cacheReadSector(vol->disk, freeBlock, buffer) != 0)
+	{
+		return 0;
 	}
 
-	return 0;
+	unsigned int nextFree;
+	char2ul(buffer, &nextFree);
+
+	vol->sb.freeBlockList = nextFree;
+	vol->sbDirty = 1;
+
+	return freeBlock;
 }
 
-int myFSOpen(Disk *d, const char *path)
+static unsigned int allocateFreeBlock(Volume *vol)
 {
-	if (d == NULL || path == NULL || strlen(path) == 0)
+	return allocateFreeBlockNear(vol, 0);
+}
+
+static unsigned int freeRunLength(Volume *vol, unsigned int b, unsigned int max)
+{
+	unsigned int len = 0;
+	while (len < max && b + len < vol->sb.numBlocks)
 	{
-		return -1;
+		unsigned int off = (b + len) % MYFS_MAPWORDBITS;
+		unsigned long long w = vol->blockMap[(b + len) / MYFS_MAPWORDBITS] >> off;
+		if (w == 0)
+		{
+			len += MYFS_MAPWORDBITS - off;
+			continue;
+		}
+		len += firstZeroBit(~w);
+		break;
 	}
+	return len < max ? len : max;
+}
 
-	if (strlen(path) > MAX_FILENAME_LENGTH)
+static unsigned int allocateBlockRun(Volume *vol, unsigned int goal, unsigned int want, unsigned int *count)
+{
+	*count = 0;
+	if (vol == NULL || vol->sb.magic != MYFS_MAGIC || want == 0)
 	{
-		return -1;
+		return 0;
 	}
 
-	int fd = -1;
-	for (int i = 0; i < MAX_FDS; i++)
+	if (vol->blockMap == NULL)
 	{
-		if (!fdTable[i].used)
-		{
-			fd = i;
-			break;
-		}
+		unsigned int blockAddr = allocateFreeBlockNear(vol, goal);
+		*count = blockAddr ? 1 : 0;
+		return blockAddr;
 	}
 
-	if (fd == -1)
+	if (vol->freeBlocks == 0)
 	{
-		return -1;
+		return 0;
+	}
+	if (want > vol->freeBlocks)
+	{
+		want = vol->freeBlocks;
 	}
 
-	unsigned int inodeNum = 0;
-	Inode *inode = NULL;
-
-	int entryIdx = findFileEntry(path);
-	if (entryIdx >= 0)
+	unsigned int start = goalBlockIndex(vol, goal);
+	unsigned int bestStart = 0;
+	unsigned int bestLen = 0;
+	unsigned int b = start;
+	unsigned int scanned = 0;
+	while (scanned < vol->sb.numBlocks && bestLen < want)
 	{
-		inodeNum = fileTable[entryIdx].inodeNum;
-		inode = inodeLoad(inodeNum, d);
-		if (inode == NULL)
+		unsigned int off = b % MYFS_MAPWORDBITS;
+		unsigned long long w = vol->blockMap[b / MYFS_MAPWORDBITS] >> off;
+		unsigned int skip = w == ~0ULL ? MYFS_MAPWORDBITS : (unsigned int)firstZeroBit(w);
+		if (skip > 0)
 		{
-			return -1;
+			if (skip > MYFS_MAPWORDBITS - off)
+			{
+				skip = MYFS_MAPWORDBITS - off;
+			}
+			b += skip;
+			scanned += skip;
+		}
+		else
+		{
+			unsigned int len = freeRunLength(vol, b, want);
+			if (len > bestLen)
+			{
+				bestStart = b;
+				bestLen = len;
+			}
+			b += len;
+			scanned += len;
+		}
+		if (b >= vol->sb.numBlocks)
+		{
+			b = 0;
+		}
+	}
+
+	if (bestLen == 0)
+	{
+		return 0;
+	}
+
+	for (unsigned int k = bestStart; k < bestStart + bestLen; k++)
+	{
+		vol->blockMap[k / MYFS_MAPWORDBITS] |= 1ULL << (k % MYFS_MAPWORDBITS);
+	}
+	markBlockMapDirty(vol, bestStart / MYFS_MAPWORDBITS);
+	markBlockMapDirty(vol, (bestStart + bestLen - 1) / MYFS_MAPWORDBITS);
+	vol->freeBlocks -= bestLen;
+	vol->blockHint = bestStart + bestLen < vol->sb.numBlocks ? bestStart + bestLen : 0;
+
+	*count = bestLen;
+	return vol->sb.dataBlockStart + bestStart * (vol->sb.blockSize / DISK_SECTORDATASIZE);
+}
+
+static int freeBlock(Volume *vol, unsigned int blockAddr)
+{
+	if (vol == NULL || vol->sb.magic != MYFS_MAGIC || blockAddr < vol->sb.dataBlockStart)
+	{
+		return -1;
+	}
+
+	if (vol->blockMap != NULL)
+	{
+		unsigned int b = (blockAddr - vol->sb.dataBlockStart) / (vol->sb.blockSize / DISK_SECTORDATASIZE);
+		unsigned long long bit = 1ULL << (b % MYFS_MAPWORDBITS);
+		if (b >= vol->sb.numBlocks || !(vol->blockMap[b / MYFS_MAPWORDBITS] & bit))
+		{
+			return -1;
+		}
+		vol->blockMap[b / MYFS_MAPWORDBITS] &= ~bit;
+		markBlockMapDirty(vol, b / MYFS_MAPWORDBITS);
+		vol->freeBlocks++;
+		return 0;
+	}
+
+	unsigned char buffer[DISK_SECTORDATASIZE];
+	memset(buffer, 0, sizeof(buffer));
+	ul2char(vol->sb.freeBlockList, buffer);
+	if (cacheWriteSector(vol->disk, blockAddr, buffer) != 0)
+	{
+		return -1;
+	}
+
+	vol->sb.freeBlockList = blockAddr;
+	vol->sbDirty = 1;
+	return 0;
+}
+
+static void releaseBlockRun(Volume *vol, unsigned int blockAddr, unsigned int count)
+{
+	unsigned int sectorsPerBlock = vol->sb.blockSize / DISK_SECTORDATASIZE;
+	if (vol->blockMap == NULL || blockAddr < vol->sb.dataBlockStart)
+	{
+		for (unsigned int k = 0; k < count; k++)
+		{
+			freeBlock(vol, blockAddr + k * sectorsPerBlock);
+		}
+		return;
+	}
+
+	unsigned int b = (blockAddr - vol->sb.dataBlockStart) / sectorsPerBlock;
+	unsigned int end = b + count < vol->sb.numBlocks ? b + count : vol->sb.numBlocks;
+	while (b < end)
+	{
+		unsigned int off = b % MYFS_MAPWORDBITS;
+		unsigned int n = MYFS_MAPWORDBITS - off < end - b ? MYFS_MAPWORDBITS - off : end - b;
+		unsigned long long mask = n == MYFS_MAPWORDBITS ? ~0ULL : ((1ULL << n) - 1) << off;
+		unsigned int word = b / MYFS_MAPWORDBITS;
+		vol->freeBlocks += countSetBits(vol->blockMap[word] & mask);
+		vol->blockMap[word] &= ~mask;
+		markBlockMapDirty(vol, word);
+		b += n;
+	}
+}
+
+static int compareBlockRuns(const void *a, const void *b)
+{
+	unsigned int x = ((const BlockRun *)a)->addr;
+	unsigned int y = ((const BlockRun *)b)->addr;
+	return (x > y) - (x < y);
+}
+
+static int truncateBlocks(Volume *vol, Inode *inode, unsigned int numBlocks)
+{
+	unsigned int oldBlocks = inodeGetNumBlocks(inode);
+	unsigned int sectorsPerBlock = vol->sb.blockSize / DISK_SECTORDATASIZE;
+	if (numBlocks >= oldBlocks)
+	{
+		return 0;
+	}
+
+	BlockRun *runs = malloc((oldBlocks - numBlocks) * sizeof(BlockRun));
+	if (runs == NULL)
+	{
+		return -1;
+	}
+
+	unsigned int numRuns = 0;
+	InodeMap map;
+	if (inodeMapBegin(&map, inode, numBlocks) != 0)
+	{
+		free(runs);
+		return -1;
+	}
+	for (unsigned int b = numBlocks; b < oldBlocks; b++)
+	{
+		unsigned int blockAddr = inodeMapNext(&map);
+		if (blockAddr == 0)
+		{
+			break;
+		}
+		if (numRuns > 0 && runs[numRuns - 1].addr + runs[numRuns - 1].count * sectorsPerBlock == blockAddr)
+		{
+			runs[numRuns - 1].count++;
+		}
+		else
+		{
+			runs[numRuns].addr = blockAddr;
+			runs[numRuns].count = 1;
+			numRuns++;
+		}
+	}
+	inodeMapEnd(&map);
+
+	if (inodeTruncate(inode, numBlocks) != 0)
+	{
+		free(runs);
+		return -1;
+	}
+
+	qsort(runs, numRuns, sizeof(BlockRun), compareBlockRuns);
+	for (unsigned int r = 0; r < numRuns; r++)
+	{
+		releaseBlockRun(vol, runs[r].addr, runs[r].count);
+	}
+	free(runs);
+	return 0;
+}
+
+static int reclaimStep(Volume *vol, unsigned int budget)
+{
+	if (vol->numReclaim == 0)
+	{
+		return 0;
+	}
+
+	int ret = -1;
+	int done = 1;
+	Inode *inode = inodeLoad(vol->reclaimQueue[0], vol->disk);
+	if (inode != NULL)
+	{
+		unsigned int numBlocks = inodeGetNumBlocks(inode);
+		unsigned int keep = numBlocks > budget ? numBlocks - budget : 0;
+		ret = truncateBlocks(vol, inode, keep);
+		if (ret == 0 && keep == 0)
+		{
+			ret = inodeFree(inode);
+		}
+		done = ret != 0 || keep == 0;
+		inodeRelease(inode);
+	}
+
+	if (done)
+	{
+		vol->numReclaim--;
+		memmove(vol->reclaimQueue, vol->reclaimQueue + 1, vol->numReclaim * sizeof(unsigned int));
+	}
+	return ret;
+}
+
+static int reclaimAll(Volume *vol)
+{
+	int ret = 0;
+	while (vol->numReclaim > 0)
+	{
+		if (reclaimStep(vol, vol->sb.numBlocks) != 0)
+		{
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+static unsigned int allocateFileBlocks(Volume *vol, unsigned int goal, unsigned int want, unsigned int *count)
+{
+	unsigned int blockAddr = allocateBlockRun(vol, goal, want, count);
+	if (blockAddr == 0 && vol->numReclaim > 0)
+	{
+		reclaimAll(vol);
+		blockAddr = allocateBlockRun(vol, goal, want, count);
+	}
+	return blockAddr;
+}
+
+static int deleteFile(Volume *vol, unsigned int inodeNum)
+{
+	Inode *inode = inodeLoad(inodeNum, vol->disk);
+	if (inode == NULL)
+	{
+		return -1;
+	}
+
+	if (inodeGetNumBlocks(inode) <= MYFS_RECLAIM_BATCHBLOCKS || !vol->reclaimerRunning)
+	{
+		int ret = truncateBlocks(vol, inode, 0) == 0 ? inodeFree(inode) : -1;
+		inodeRelease(inode);
+		return ret;
+	}
+	inodeRelease(inode);
+
+	if (vol->numReclaim == vol->reclaimSize)
+	{
+		unsigned int newSize = vol->reclaimSize ? vol->reclaimSize * 2 : 16;
+		unsigned int *newQueue = realloc(vol->reclaimQueue, newSize * sizeof(unsigned int));
+		if (newQueue == NULL)
+		{
+			return -1;
+		}
+		vol->reclaimQueue = newQueue;
+		vol->reclaimSize = newSize;
+	}
+	vol->reclaimQueue[vol->numReclaim++] = inodeNum;
+	pthread_cond_signal(&vol->reclaimWake);
+	return 0;
+}
+
+static unsigned int allocateNodeBlock(Disk *d, unsigned int goal)
+{
+	return allocateFreeBlockNear(findVolume(d), goal);
+}
+
+static int freeNodeBlock(Disk *d, unsigned int blockAddr)
+{
+	return freeBlock(findVolume(d), blockAddr);
+}
+
+static int flushVolume(Volume *vol)
+{
+	vol->lastFlush = diskGetTime(vol->disk);
+	vol->dirtyUpdates = 0;
+	if (saveBlockMap(vol) != 0 || flushSuperblock(vol) != 0)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+static void flushVolumeIfDue(Volume *vol)
+{
+	if (vol->dirtyUpdates >= MYFS_FLUSH_MAXDIRTY ||
+	    diskGetTime(vol->disk) - vol->lastFlush >= MYFS_FLUSH_INTERVALMS)
+	{
+		flushVolume(vol);
+	}
+}
+
+// Large deletions are queued by deleteFile and drained here, one batch of
+// MYFS_RECLAIM_BATCHBLOCKS blocks per volume lock hold, so callers never wait
+// for more than one batch. allocateFileBlocks still drains the queue itself
+// when the volume runs out of space.
+static void *reclaimThread(void *arg)
+{
+	Volume *vol = arg;
+
+	lockVolume(vol);
+	while (!vol->stopReclaim)
+	{
+		if (vol->numReclaim == 0)
+		{
+			pthread_cond_wait(&vol->reclaimWake, &volumeLocks[vol - volumes]);
+			continue;
+		}
+
+		reclaimStep(vol, MYFS_RECLAIM_BATCHBLOCKS);
+		flushVolumeIfDue(vol);
+
+		unlockVolume(vol);
+		sched_yield();
+		lockVolume(vol);
+	}
+	unlockVolume(vol);
+
+	return NULL;
+}
+
+static void startReclaimer(Volume *vol)
+{
+	vol->stopReclaim = 0;
+	pthread_cond_init(&vol->reclaimWake, NULL);
+	vol->reclaimerRunning = pthread_create(&vol->reclaimer, NULL, reclaimThread, vol) == 0;
+	if (!vol->reclaimerRunning)
+	{
+		pthread_cond_destroy(&vol->reclaimWake);
+	}
+}
+
+static void stopReclaimer(Volume *vol)
+{
+	if (!vol->reclaimerRunning)
+	{
+		return;
+	}
+
+	lockVolume(vol);
+	vol->stopReclaim = 1;
+	vol->reclaimerRunning = 0;
+	pthread_cond_signal(&vol->reclaimWake);
+	unlockVolume(vol);
+
+	pthread_join(vol->reclaimer, NULL);
+	pthread_cond_destroy(&vol->reclaimWake);
+}
+
+static int syncVolume(Volume *vol)
+{
+	if (inodeSync(vol->disk) != 0 || flushVolume(vol) != 0)
+	{
+		return -1;
+	}
+	return cacheSync(vol->disk);
+}
+
+static int growInodeTable(Volume *vol)
+{
+	unsigned int inodesPerSector = inodeNumInodesPerSector();
+	unsigned int inodesPerBlock = vol->sb.blockSize / DISK_SECTORDATASIZE * inodesPerSector;
+	unsigned int growBlocks = (vol->inodeRegions[0].numInodes + inodesPerBlock - 1) / inodesPerBlock;
+	unsigned int added = 0;
+
+	if (vol->sb.numInodeRegions == 0)
+	{
+		return -1;
+	}
+
+	for (unsigned int b = 0; b < growBlocks; b++)
+	{
+		if (vol->sb.numInodes + inodesPerBlock > vol->sb.maxInodes)
+		{
+			break;
+		}
+
+		InodeRegionEntry *last = &vol->inodeRegions[vol->sb.numInodeRegions - 1];
+		unsigned int blockAddr = allocateFreeBlockNear(vol, last->start + last->numInodes / inodesPerSector);
+		if (blockAddr == 0)
+		{
+			break;
 		}
+
+		int contiguous = last->start + last->numInodes / inodesPerSector == blockAddr;
+		if ((!contiguous && vol->sb.numInodeRegions == MYFS_MAX_INODEREGIONS) ||
+		    inodeAddRegion(vol->disk, blockAddr, inodesPerBlock) != 0)
+		{
+			freeBlock(vol, blockAddr);
+			break;
+		}
+
+		if (contiguous)
+		{
+			last->numInodes += inodesPerBlock;
+		}
+		else
+		{
+			last = &vol->inodeRegions[vol->sb.numInodeRegions++];
+			last->start = blockAddr;
+			last->numInodes = inodesPerBlock;
+		}
+		vol->sb.numInodes += inodesPerBlock;
+		added++;
+	}
+
+	if (added == 0)
+	{
+		return -1;
+	}
+
+	vol->sbDirty = 1;
+	return saveInodeRegions(vol);
+}
+
+static int formatVolume(Volume *vol, Disk *d, unsigned int blockSize)
+{
+	unsigned long numSectors = diskGetNumSectors(d);
+	unsigned int inodesPerSector = inodeNumInodesPerSector();
+	unsigned int inodeSectors = (numSectors * DISK_SECTORDATASIZE / MYFS_BYTES_PER_INODE
+	                             + inodesPerSector - 1) / inodesPerSector;
+	if (inodeSectors == 0)
+	{
+		inodeSectors = 1;
+	}
+	unsigned int numInodes = inodeSectors * inodesPerSector;
+	unsigned int maxInodes = numSectors * inodesPerSector;
+	unsigned int inodeTableStart = INODE_BEGINSECTOR;
+	unsigned int bitmapStart = inodeTableStart + inodeSectors;
+	unsigned int bitmapSectors = maxInodes / (DISK_SECTORDATASIZE * 8) + 1;
+	unsigned int sectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
+	unsigned int blockBitmapStart = bitmapStart + bitmapSectors;
+	unsigned int blockBitmapSectors = blockMapSectors(numSectors / sectorsPerBlock);
+	unsigned int dataBlockStart = blockBitmapStart + blockBitmapSectors;
+	if (dataBlockStart + sectorsPerBlock > numSectors)
+	{
+		return -1;
+	}
+	unsigned int dataAreaSectors = numSectors - dataBlockStart;
+	unsigned int numBlocks = dataAreaSectors / sectorsPerBlock;
+
+	inodeInvalidate(d);
+	cacheInvalidate(d);
+	inodeSetBlockSize(d, blockSize);
+
+	vol->disk = d;
+	vol->sb.magic = MYFS_MAGIC;
+	vol->sb.blockSize = blockSize;
+	vol->sb.numBlocks = numBlocks;
+	vol->sb.numInodes = numInodes;
+	vol->sb.inodeTableStart = inodeTableStart;
+	vol->sb.dataBlockStart = dataBlockStart;
+	vol->sb.freeBlockList = 0;
+	vol->sb.rootInode = 1;
+	vol->sb.inodeBitmapStart = bitmapStart;
+	vol->sb.maxInodes = maxInodes;
+	vol->sb.numInodeRegions = 1;
+	vol->sb.blockBitmapStart = blockBitmapStart;
+	vol->inodeRegions[0].start = inodeTableStart;
+	vol->inodeRegions[0].numInodes = numInodes;
+
+	if (saveSuperblock(vol) != 0 || saveInodeRegions(vol) != 0)
+	{
+		return -1;
+	}
+
+	if (createBlockMap(vol) != 0)
+	{
+		return -1;
+	}
+
+	if (inodeAddRegion(d, inodeTableStart, numInodes) != 0 ||
+	    inodeLoadBitmap(d, maxInodes, bitmapStart, 0) != 0)
+	{
+		return -1;
+	}
+
+	Inode *rootInode = inodeCreate(1, d);
+	if (rootInode == NULL)
+	{
+		return -1;
+	}
+
+	unsigned int rootBlock = allocateFreeBlock(vol);
+	if (rootBlock == 0)
+	{
+		inodeRelease(rootInode);
+		return -1;
+	}
+
+	if (inodeAddBlock(rootInode, rootBlock) != 0)
+	{
+		inodeRelease(rootInode);
+		return -1;
+	}
+
+	inodeSetFileType(rootInode, FILETYPE_DIR);
+	inodeSetFileSize(rootInode, 0);
+	inodeSetOwner(rootInode, 0);
+	inodeSetGroupOwner(rootInode, 0);
+	inodeSetPermission(rootInode, 0755);
+
+	if (inodeSave(rootInode) != 0)
+	{
+		inodeRelease(rootInode);
+		return -1;
+	}
+
+	inodeRelease(rootInode);
+
+	if (updateInodeTableInit(vol) != 0)
+	{
+		return -1;
+	}
+
+	if (syncVolume(vol) != 0)
+	{
+		return -1;
+	}
+	inodeInvalidate(d);
+	cacheInvalidate(d);
+
+	return numBlocks;
+}
+
+int myFSFormat(Disk *d, unsigned int blockSize)
+{
+	if (d == NULL || blockSize == 0 || blockSize % DISK_SECTORDATASIZE != 0)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&mountLock);
+	Volume *vol = findVolume(d) == NULL ? calloc(1, sizeof(Volume)) : NULL;
+	if (vol == NULL)
+	{
+		pthread_mutex_unlock(&mountLock);
+		return -1;
+	}
+
+	int ret = formatVolume(vol, d, blockSize);
+	pthread_mutex_unlock(&mountLock);
+	free(vol->blockMap);
+	free(vol);
+
+	return ret;
+}
+
+static int mountVolume(Disk *d)
+{
+	if (findVolume(d) != NULL)
+	{
+		return 0;
+	}
+
+	Volume *vol = NULL;
+	pthread_mutex_lock(&volumesLock);
+	for (int i = 0; i < MYFS_MAX_VOLUMES; i++)
+	{
+		if (!volumes[i].used)
+		{
+			vol = &volumes[i];
+			memset(vol, 0, sizeof(Volume));
+			break;
+		}
+	}
+	pthread_mutex_unlock(&volumesLock);
+	if (vol == NULL)
+	{
+		return 0;
+	}
+
+	inodeInvalidate(d);
+	cacheInvalidate(d);
+
+	unsigned char buffer[DISK_SECTORDATASIZE];
+	if (cacheReadSector(d, 0, buffer) != 0)
+	{
+		return 0;
+	}
+
+	superblock sb;
+	decodeSuperblock(buffer, &sb);
+
+	if (sb.magic != MYFS_MAGIC)
+	{
+		return 0;
+	}
+
+	if (sb.blockSize == 0 || sb.blockSize % DISK_SECTORDATASIZE != 0)
+	{
+		return 0;
+	}
+
+	if (sb.numBlocks == 0 || sb.numInodes == 0 || sb.inodeBitmapStart == 0)
+	{
+		return 0;
+	}
+
+	if (sb.inodeTableInit == 0)
+	{
+		sb.inodeTableInit = sb.numInodes;
+	}
+
+	if (sb.maxInodes == 0)
+	{
+		sb.maxInodes = sb.numInodes;
+	}
+
+	if (sb.blockBitmapStart != 0 && sb.blockBitmapInit == 0)
+	{
+		sb.blockBitmapInit = blockMapSectors(sb.numBlocks);
+	}
+
+	vol->disk = d;
+	vol->sb = sb;
+
+	if (loadInodeRegions(vol) != 0 ||
+	    inodeLoadBitmap(d, sb.maxInodes, sb.inodeBitmapStart, sb.inodeTableInit) != 0 ||
+	    loadBlockMap(vol) != 0)
+	{
+		inodeInvalidate(d);
+		free(vol->blockMap);
+		vol->blockMap = NULL;
+		return 0;
+	}
+
+	vol->lastFlush = diskGetTime(d);
+	inodeSetBlockSize(d, sb.blockSize);
+	inodeSetAllocator(d, allocateNodeBlock, freeNodeBlock);
+
+	startReclaimer(vol);
+
+	lockVolume(vol);
+	pthread_mutex_lock(&volumesLock);
+	vol->used = 1;
+	pthread_mutex_unlock(&volumesLock);
+	unlockVolume(vol);
+
+	return 1;
+}
+
+static int unmountVolume(Disk *d)
+{
+	Volume *vol = findVolume(d);
+	if (vol == NULL || !myFSIsIdle(d))
+	{
+		return 0;
+	}
+
+	stopReclaimer(vol);
+	lockVolume(vol);
+	if (!myFSIsIdle(d))
+	{
+		startReclaimer(vol);
+		unlockVolume(vol);
+		return 0;
+	}
+
+	pthread_mutex_lock(&fdLock);
+	for (int i = 0; i < MAX_FDS; i++)
+	{
+		if (fdTable[i].disk == d)
+		{
+			if (fdTable[i].inode != NULL)
+			{
+				inodeRelease(fdTable[i].inode);
+			}
+			memset(&fdTable[i], 0, sizeof(FileDescriptor));
+		}
+	}
+	pthread_mutex_unlock(&fdLock);
+
+	if (reclaimAll(vol) != 0 || syncVolume(vol) != 0)
+	{
+		startReclaimer(vol);
+		unlockVolume(vol);
+		return 0;
+	}
+	inodeInvalidate(d);
+	cacheInvalidate(d);
+
+	free(vol->blockMap);
+	free(vol->reclaimQueue);
+	free(vol->fileTable);
+	pthread_mutex_lock(&volumesLock);
+	memset(vol, 0, sizeof(Volume));
+	pthread_mutex_unlock(&volumesLock);
+	unlockVolume(vol);
+
+	return 1;
+}
+
+int myFSxMount(Disk *d, int x)
+{
+	if (d == NULL || (x != 0 && x != 1))
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&mountLock);
+	int ret = x == 1 ? mountVolume(d) : unmountVolume(d);
+	pthread_mutex_unlock(&mountLock);
+
+	return ret;
+}
+
+static int openFile(Volume *vol, int fd, const char *path)
+{
+	Disk *d = vol->disk;
+	unsigned int inodeNum = 0;
+	Inode *inode = NULL;
+
+	int entryIdx = findFileEntry(vol, path);
+	if (entryIdx >= 0)
+	{
+		inodeNum = vol->fileTable[entryIdx].inodeNum;
+		inode = inodeLoad(inodeNum, d);
+		if (inode == NULL)
+		{
+			return -1;
+		}
+	}
+	else
+	{
+		inodeNum = inodeFindFreeInode(2, d);
+		if (inodeNum == 0 && growInodeTable(vol) == 0)
+		{
+			inodeNum = inodeFindFreeInode(2, d);
+		}
+		if (inodeNum == 0)
+		{
+			return -1;
+		}
+
+		unsigned int firstCount;
+		unsigned int firstBlock = allocateFileBlocks(vol, 0, 1, &firstCount);
+		if (firstBlock == 0)
+		{
+			return -1;
+		}
+
+		inode = inodeCreate(inodeNum, d);
+		if (inode == NULL)
+		{
+			return -1;
+		}
+		updateInodeTableInit(vol);
+
+		inodeSetFileType(inode, FILETYPE_REGULAR);
+		inodeSetFileSize(inode, 0);
+		inodeSetOwner(inode, 0);
+		inodeSetGroupOwner(inode, 0);
+		inodeSetPermission(inode, 0644);
+
+		if (inodeAddBlock(inode, firstBlock) != 0)
+		{
+			inodeRelease(inode);
+			return -1;
+		}
+
+		if (addFileEntry(vol, path, inodeNum) < 0)
+		{
+			inodeRelease(inode);
+			return -1;
+		}
+	}
+
+	fdTable[fd].inodeNum = inodeNum;
+	fdTable[fd].inode = inode;
+	flushVolumeIfDue(vol);
+
+	return fd + 1;
+}
+
+int myFSOpen(Disk *d, const char *path)
+{
+	if (d == NULL || path == NULL || strlen(path) == 0)
+	{
+		return -1;
+	}
+
+	if (strlen(path) > MAX_FILENAME_LENGTH)
+	{
+		return -1;
+	}
+
+	Volume *vol = lockVolumeOf(d);
+	if (vol == NULL)
+	{
+		return -1;
+	}
+
+	int fd = allocDescriptor(vol, 0);
+	int ret = fd < 0 ? -1 : openFile(vol, fd, path);
+	if (ret < 0 && fd >= 0)
+	{
+		releaseDescriptor(fd);
+	}
+	unlockVolume(vol);
+
+	return ret;
+}
+
+static void updateReadahead(FileDescriptor *f, unsigned int blockSize)
+{
+	unsigned int maxBlocks = MYFS_READAHEAD_MAXSECTORS / (blockSize / DISK_SECTORDATASIZE);
+	if (maxBlocks == 0)
+	{
+		maxBlocks = 1;
+	}
+
+	if (f->cursor != f->lastReadEnd)
+	{
+		f->raWindow = 0;
+		f->raNext = 0;
+		return;
+	}
+
+	if (f->raWindow == 0)
+	{
+		f->raWindow = MYFS_READAHEAD_MINBLOCKS;
+	}
+	else
+	{
+		f->raWindow *= 2;
+	}
+
+	if (f->raWindow > maxBlocks)
+	{
+		f->raWindow = maxBlocks;
+	}
+}
+
+static unsigned int addReadahead(FileDescriptor *f, CacheRange *ranges, unsigned int lastBlock,
+                                 unsigned int fileSize, unsigned int blockSize)
+{
+	unsigned int fileBlocks = (fileSize + blockSize - 1) / blockSize;
+	unsigned int start = lastBlock + 1;
+	unsigned int end = lastBlock + 1 + f->raWindow;
+	unsigned int numAhead = 0;
+
+	if (f->raNext > start)
+	{
+		start = f->raNext;
+	}
+	if (end > fileBlocks)
+	{
+		end = fileBlocks;
+	}
+
+	InodeMap map;
+	if (start >= end || inodeMapBegin(&map, f->inode, start) != 0)
+	{
+		return 0;
+	}
+
+	unsigned int b;
+	for (b = start; b < end; b++)
+	{
+		unsigned int blockAddr = inodeMapNext(&map);
+		if (blockAddr == 0)
+		{
+			break;
+		}
+		ranges[numAhead].addr = blockAddr;
+		ranges[numAhead].numSectors = blockSize / DISK_SECTORDATASIZE;
+		ranges[numAhead].data = NULL;
+		numAhead++;
+	}
+	inodeMapEnd(&map);
+
+	if (b > f->raNext)
+	{
+		f->raNext = b;
+	}
+
+	return numAhead;
+}
+
+static int readFile(int fd, char *buf, unsigned int nbytes)
+{
+	int idx = fd - 1;
+
+	if (idx < 0 || idx >= MAX_FDS || !fdTable[idx].used)
+	{
+		return -1;
+	}
+
+	if (buf == NULL || nbytes == 0)
+	{
+		return -1;
+	}
+
+	Inode *inode = fdTable[idx].inode;
+	Disk *disk = fdTable[idx].disk;
+	if (inode == NULL || disk == NULL)
+	{
+		return -1;
+	}
+
+	unsigned int fileSize = inodeGetFileSize(inode);
+	unsigned int cursor = fdTable[idx].cursor;
+
+	if (cursor >= fileSize)
+	{
+		return 0;
 	}
-	else
+
+	unsigned int bytesToRead = nbytes;
+	if (cursor + bytesToRead > fileSize)
 	{
-		inodeNum = inodeFindFreeInode(2, d);
-		if (inodeNum == 0)
+		bytesToRead = fileSize - cursor;
+	}
+
+	unsigned int totalRead = 0;
+	unsigned int blockSize = fdTable[idx].volume->sb.blockSize;
+	unsigned int numSectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
+	unsigned int lastBlock = (cursor + bytesToRead - 1) / blockSize;
+
+	updateReadahead(&fdTable[idx], blockSize);
+
+	unsigned char *chunk = malloc(MYFS_MAXBATCHBLOCKS * blockSize);
+	if (chunk == NULL)
+	{
+		return -1;
+	}
+
+	InodeMap map;
+	if (inodeMapBegin(&map, inode, cursor / blockSize) != 0)
+	{
+		free(chunk);
+		return -1;
+	}
+
+	while (totalRead < bytesToRead)
+	{
+		unsigned int currentPos = cursor + totalRead;
+		unsigned int firstBlock = currentPos / blockSize;
+		unsigned int numBlocks = (cursor + bytesToRead - 1) / blockSize - firstBlock + 1;
+		if (numBlocks > MYFS_MAXBATCHBLOCKS)
+		{
+			numBlocks = MYFS_MAXBATCHBLOCKS;
+		}
+
+		CacheRange ranges[MYFS_MAXBATCHBLOCKS + MYFS_READAHEAD_MAXSECTORS];
+		unsigned int numRanges = 0;
+		unsigned int numAhead = 0;
+		for (unsigned int b = 0; b < numBlocks; b++)
+		{
+			unsigned int blockAddr = inodeMapNext(&map);
+			if (blockAddr == 0)
+			{
+				break;
+			}
+			ranges[numRanges].addr = blockAddr;
+			ranges[numRanges].numSectors = numSectorsPerBlock;
+			ranges[numRanges].data = chunk + b * blockSize;
+			numRanges++;
+		}
+
+		if (numRanges == 0)
+		{
+			break;
+		}
+
+		if (firstBlock + numRanges - 1 == lastBlock && fdTable[idx].raWindow > 0)
+		{
+			numAhead = addReadahead(&fdTable[idx], ranges + numRanges, lastBlock, fileSize, blockSize);
+		}
+
+		if (cacheReadRanges(disk, ranges, numRanges + numAhead) != 0)
 		{
+			inodeMapEnd(&map);
+			free(chunk);
 			return -1;
 		}
 
-		unsigned int firstBlock = allocateFreeBlock(d);
-		if (firstBlock == 0)
+		unsigned int offsetInChunk = currentPos % blockSize;
+		unsigned int bytesFromChunk = numRanges * blockSize - offsetInChunk;
+		if (bytesFromChunk > bytesToRead - totalRead)
+		{
+			bytesFromChunk = bytesToRead - totalRead;
+		}
+
+		memcpy(buf + totalRead, chunk + offsetInChunk, bytesFromChunk);
+		totalRead += bytesFromChunk;
+
+		if (numRanges < numBlocks)
+		{
+			break;
+		}
+	}
+
+	inodeMapEnd(&map);
+	free(chunk);
+
+	fdTable[idx].cursor += totalRead;
+	fdTable[idx].lastReadEnd = fdTable[idx].cursor;
+
+	return totalRead;
+}
+
+int myFSRead(int fd, char *buf, unsigned int nbytes)
+{
+	Volume *vol = lockDescriptor(fd);
+	if (vol == NULL)
+	{
+		return -1;
+	}
+
+	int ret = readFile(fd, buf, nbytes);
+	unlockVolume(vol);
+
+	return ret;
+}
+
+static int writeFile(int fd, const char *buf, unsigned int nbytes)
+{
+	int idx = fd - 1;
+
+	if (idx < 0 || idx >= MAX_FDS || !fdTable[idx].used)
+	{
+		return -1;
+	}
+
+	if (buf == NULL || nbytes == 0)
+	{
+		return -1;
+	}
+
+	Inode *inode = fdTable[idx].inode;
+	Disk *disk = fdTable[idx].disk;
+	if (inode == NULL || disk == NULL)
+	{
+		return -1;
+	}
+
+	unsigned int cursor = fdTable[idx].cursor;
+	unsigned int totalWritten = 0;
+	unsigned int blockSize = fdTable[idx].volume->sb.blockSize;
+	unsigned int numSectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
+
+	unsigned char *chunk = malloc(MYFS_MAXBATCHBLOCKS * blockSize);
+	if (chunk == NULL)
+	{
+		return -1;
+	}
+
+	unsigned int prevAddr = cursor / blockSize > 0 ? inodeGetBlockAddr(inode, cursor / blockSize - 1) : 0;
+	unsigned int lastWriteBlock = (cursor + nbytes - 1) / blockSize;
+	unsigned int runAddr = 0;
+	unsigned int runLeft = 0;
+
+	InodeMap map;
+	if (inodeMapBegin(&map, inode, cursor / blockSize) != 0)
+	{
+		free(chunk);
+		return -1;
+	}
+
+	while (totalWritten < nbytes)
+	{
+		unsigned int currentPos = cursor + totalWritten;
+		unsigned int firstBlock = currentPos / blockSize;
+		unsigned int numBlocks = (cursor + nbytes - 1) / blockSize - firstBlock + 1;
+		if (numBlocks > MYFS_MAXBATCHBLOCKS)
+		{
+			numBlocks = MYFS_MAXBATCHBLOCKS;
+		}
+
+		unsigned int blockAddrs[MYFS_MAXBATCHBLOCKS];
+		CacheRange ranges[MYFS_MAXBATCHBLOCKS];
+		unsigned int numRanges = 0;
+		unsigned int chunkEnd = (firstBlock + numBlocks) * blockSize;
+		if (chunkEnd > cursor + nbytes)
+		{
+			chunkEnd = cursor + nbytes;
+		}
+
+		for (unsigned int b = 0; b < numBlocks; b++)
+		{
+			unsigned int blockStart = (firstBlock + b) * blockSize;
+			int isNew = 0;
+
+			blockAddrs[b] = inodeMapNext(&map);
+			if (blockAddrs[b] == 0)
+			{
+				if (runLeft == 0)
+				{
+					runAddr = allocateFileBlocks(fdTable[idx].volume, prevAddr ? prevAddr + numSectorsPerBlock : 0,
+					                             lastWriteBlock - (firstBlock + b) + 1, &runLeft);
+				}
+				if (runLeft == 0 || inodeAddBlock(inode, runAddr) != 0)
+				{
+					releaseBlockRun(fdTable[idx].volume, runAddr, runLeft);
+					inodeMapEnd(&map);
+					free(chunk);
+					return -1;
+				}
+
+				blockAddrs[b] = runAddr;
+				runAddr += numSectorsPerBlock;
+				runLeft--;
+				isNew = 1;
+			}
+			prevAddr = blockAddrs[b];
+
+			if (blockStart >= currentPos && blockStart + blockSize <= chunkEnd)
+			{
+				continue;
+			}
+
+			if (isNew)
+			{
+				memset(chunk + b * blockSize, 0, blockSize);
+				continue;
+			}
+
+			ranges[numRanges].addr = blockAddrs[b];
+			ranges[numRanges].numSectors = numSectorsPerBlock;
+			ranges[numRanges].data = chunk + b * blockSize;
+			numRanges++;
+		}
+
+		if (cacheReadRanges(disk, ranges, numRanges) != 0)
 		{
+			releaseBlockRun(fdTable[idx].volume, runAddr, runLeft);
+			inodeMapEnd(&map);
+			free(chunk);
 			return -1;
 		}
 
-		inode = inodeCreate(inodeNum, d);
-		if (inode == NULL)
+		unsigned int offsetInChunk = currentPos % blockSize;
+		unsigned int bytesToChunk = chunkEnd - currentPos;
+
+		memcpy(chunk + offsetInChunk, buf + totalWritten, bytesToChunk);
+
+		for (unsigned int b = 0; b < numBlocks; b++)
+		{
+			if (cacheWriteSectors(disk, blockAddrs[b], numSectorsPerBlock, chunk + b * blockSize) != 0)
+			{
+				releaseBlockRun(fdTable[idx].volume, runAddr, runLeft);
+				inodeMapEnd(&map);
+				free(chunk);
+				return -1;
+			}
+		}
+
+		totalWritten += bytesToChunk;
+	}
+
+	releaseBlockRun(fdTable[idx].volume, runAddr, runLeft);
+	inodeMapEnd(&map);
+	free(chunk);
+
+	fdTable[idx].cursor += totalWritten;
+
+	unsigned int newSize = fdTable[idx].cursor;
+	unsigned int oldSize = inodeGetFileSize(inode);
+	if (newSize > oldSize)
+	{
+		inodeSetFileSize(inode, newSize);
+		inodeSave(inode);
+	}
+	flushVolumeIfDue(fdTable[idx].volume);
+
+	return totalWritten;
+}
+
+int myFSWrite(int fd, const char *buf, unsigned int nbytes)
+{
+	Volume *vol = lockDescriptor(fd);
+	if (vol == NULL)
+	{
+		return -1;
+	}
+
+	int ret = writeFile(fd, buf, nbytes);
+	unlockVolume(vol);
+
+	return ret;
+}
+
+static void completeAsyncIO(DiskIO *io, void *arg)
+{
+	AsyncRequest *req = arg;
+
+	pthread_mutex_lock(&aioLock);
+	if (io->status != 0)
+	{
+		req->status = -1;
+	}
+	req->pending--;
+	if (req->pending == 0)
+	{
+		pthread_cond_broadcast(&aioDone);
+	}
+	pthread_mutex_unlock(&aioLock);
+}
+
+static AsyncRequest *newAsyncRequest(int fd, int write, unsigned int numBlocks, unsigned int blockSize)
+{
+	AsyncRequest *req = NULL;
+	pthread_mutex_lock(&aioLock);
+	for (int i = 0; i < MYFS_MAX_AIOS; i++)
+	{
+		if (!aioTable[i].used)
+		{
+			req = &aioTable[i];
+			memset(req, 0, sizeof(AsyncRequest));
+			req->data = malloc(numBlocks * blockSize + 1);
+			req->ios = malloc((numBlocks * (blockSize / DISK_SECTORDATASIZE) + 1) * sizeof(DiskIO));
+			if (req->data == NULL || req->ios == NULL)
+			{
+				free(req->data);
+				free(req->ios);
+				memset(req, 0, sizeof(AsyncRequest));
+				req = NULL;
+				break;
+			}
+			req->used = 1;
+			req->fd = fd;
+			req->write = write;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&aioLock);
+	return req;
+}
+
+static void freeAsyncRequest(AsyncRequest *req)
+{
+	free(req->data);
+	free(req->ios);
+	pthread_mutex_lock(&aioLock);
+	memset(req, 0, sizeof(AsyncRequest));
+	pthread_mutex_unlock(&aioLock);
+}
+
+static void addAsyncRun(AsyncRequest *req, unsigned int addr, unsigned int numSectors, unsigned char *data)
+{
+	if (req->numIOs > 0)
+	{
+		DiskIO *last = &req->ios[req->numIOs - 1];
+		if (last->addr + last->numSectors == addr && last->data + last->numSectors * DISK_SECTORDATASIZE == data)
+		{
+			last->numSectors += numSectors;
+			return;
+		}
+	}
+
+	DiskIO *io = &req->ios[req->numIOs++];
+	memset(io, 0, sizeof(DiskIO));
+	io->write = req->write;
+	io->addr = addr;
+	io->numSectors = numSectors;
+	io->data = data;
+	io->callback = completeAsyncIO;
+	io->arg = req;
+}
+
+static int submitAsyncRequest(AsyncRequest *req, Disk *disk)
+{
+	DiskIO **submit = malloc((req->numIOs + 1) * sizeof(DiskIO *));
+	if (submit == NULL)
+	{
+		freeAsyncRequest(req);
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < req->numIOs; i++)
+	{
+		submit[i] = &req->ios[i];
+	}
+	pthread_mutex_lock(&aioLock);
+	req->pending = req->numIOs;
+	pthread_mutex_unlock(&aioLock);
+
+	if (diskSubmit(disk, submit, req->numIOs) != 0)
+	{
+		free(submit);
+		freeAsyncRequest(req);
+		return -1;
+	}
+
+	free(submit);
+	return (int)(req - aioTable) + 1;
+}
+
+static void waitAsyncRequests(int fd)
+{
+	pthread_mutex_lock(&aioLock);
+	for (int i = 0; i < MYFS_MAX_AIOS; i++)
+	{
+		while (aioTable[i].used && aioTable[i].fd == fd && aioTable[i].pending > 0)
+		{
+			pthread_cond_wait(&aioDone, &aioLock);
+		}
+	}
+	pthread_mutex_unlock(&aioLock);
+}
+
+static int readFileAsync(int fd, char *buf, unsigned int nbytes)
+{
+	int idx = fd - 1;
+
+	if (idx < 0 || idx >= MAX_FDS || !fdTable[idx].used)
+	{
+		return -1;
+	}
+
+	if (buf == NULL || nbytes == 0)
+	{
+		return -1;
+	}
+
+	Inode *inode = fdTable[idx].inode;
+	Disk *disk = fdTable[idx].disk;
+	if (inode == NULL || disk == NULL)
+	{
+		return -1;
+	}
+
+	unsigned int fileSize = inodeGetFileSize(inode);
+	unsigned int cursor = fdTable[idx].cursor;
+	unsigned int bytesToRead = cursor < fileSize ? fileSize - cursor : 0;
+	if (bytesToRead > nbytes)
+	{
+		bytesToRead = nbytes;
+	}
+
+	unsigned int blockSize = fdTable[idx].volume->sb.blockSize;
+	unsigned int numSectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
+	unsigned int firstBlock = cursor / blockSize;
+	unsigned int numBlocks = bytesToRead > 0 ? (cursor + bytesToRead - 1) / blockSize - firstBlock + 1 : 0;
+
+	AsyncRequest *req = newAsyncRequest(fd, 0, numBlocks, blockSize);
+	if (req == NULL)
+	{
+		return -1;
+	}
+	req->buf = buf;
+	req->offset = cursor % blockSize;
+	req->nbytes = bytesToRead;
+
+	if (numBlocks > 0)
+	{
+		InodeMap map;
+		if (inodeMapBegin(&map, inode, firstBlock) != 0)
 		{
+			freeAsyncRequest(req);
 			return -1;
 		}
+		for (unsigned int b = 0; b < numBlocks; b++)
+		{
+			unsigned int blockAddr = inodeMapNext(&map);
+			if (blockAddr == 0)
+			{
+				inodeMapEnd(&map);
+				freeAsyncRequest(req);
+				return -1;
+			}
+			for (unsigned int k = 0; k < numSectorsPerBlock; k++)
+			{
+				unsigned char *sectorData = req->data + b * blockSize + k * DISK_SECTORDATASIZE;
+				if (!cachePeekSector(disk, blockAddr + k, sectorData))
+				{
+					addAsyncRun(req, blockAddr + k, 1, sectorData);
+				}
+			}
+		}
+		inodeMapEnd(&map);
+	}
 
-		inodeSetFileType(inode, FILETYPE_REGULAR);
-		inodeSetFileSize(inode, 0);
-		inodeSetOwner(inode, 0);
-		inodeSetGroupOwner(inode, 0);
-		inodeSetPermission(inode, 0644);
+	int id = submitAsyncRequest(req, disk);
+	if (id < 0)
+	{
+		return -1;
+	}
 
-		if (inodeAddBlock(inode, firstBlock) != 0)
-		{
-			free(inode);
-			return -1;
-		}
+	fdTable[idx].cursor += bytesToRead;
+	fdTable[idx].lastReadEnd = fdTable[idx].cursor;
+	return id;
+}
 
-		if (addFileEntry(path, inodeNum) < 0)
-		{
-			free(inode);
-			return -1;
-		}
+int myFSReadAsync(int fd, char *buf, unsigned int nbytes)
+{
+	Volume *vol = lockDescriptor(fd);
+	if (vol == NULL)
+	{
+		return -1;
 	}
 
-	fdTable[fd].used = 1;
-	fdTable[fd].disk = d;
-	fdTable[fd].inodeNum = inodeNum;
-	fdTable[fd].cursor = 0;
-	fdTable[fd].inode = inode;
+	int ret = readFileAsync(fd, buf, nbytes);
+	unlockVolume(vol);
 
-	return fd + 1;
+	return ret;
 }
 
-int myFSRead(int fd, char *buf, unsigned int nbytes)
+static int writeFileAsync(int fd, const char *buf, unsigned int nbytes)
 {
 	int idx = fd - 1;
 
@@ -460,189 +2106,362 @@ int myFSRead(int fd, char *buf, unsigned int nbytes)
 
 	Inode *inode = fdTable[idx].inode;
 	Disk *disk = fdTable[idx].disk;
+	Volume *vol = fdTable[idx].volume;
 	if (inode == NULL || disk == NULL)
 	{
 		return -1;
 	}
 
-	unsigned int fileSize = inodeGetFileSize(inode);
 	unsigned int cursor = fdTable[idx].cursor;
-
-	if (cursor >= fileSize)
+	unsigned int blockSize = vol->sb.blockSize;
+	unsigned int numSectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
+	unsigned int firstBlock = cursor / blockSize;
+	unsigned int lastBlock = (cursor + nbytes - 1) / blockSize;
+	unsigned int numBlocks = lastBlock - firstBlock + 1;
+
+	AsyncRequest *req = newAsyncRequest(fd, 1, numBlocks, blockSize);
+	if (req == NULL)
 	{
-		return 0;
+		return -1;
 	}
+	req->nbytes = nbytes;
 
-	unsigned int bytesToRead = nbytes;
-	if (cursor + bytesToRead > fileSize)
+	unsigned int prevAddr = firstBlock > 0 ? inodeGetBlockAddr(inode, firstBlock - 1) : 0;
+	unsigned int runAddr = 0;
+	unsigned int runLeft = 0;
+
+	InodeMap map;
+	if (inodeMapBegin(&map, inode, firstBlock) != 0)
 	{
-		bytesToRead = fileSize - cursor;
+		freeAsyncRequest(req);
+		return -1;
 	}
 
-	unsigned int totalRead = 0;
-	unsigned int blockSize = sb.blockSize;
-
-	while (totalRead < bytesToRead)
+	for (unsigned int b = 0; b < numBlocks; b++)
 	{
-		unsigned int currentPos = cursor + totalRead;
-		unsigned int blockNum = currentPos / blockSize;
-		unsigned int offsetInBlock = currentPos % blockSize;
+		unsigned int blockStart = (firstBlock + b) * blockSize;
+		unsigned char *blockData = req->data + b * blockSize;
+		unsigned int blockAddr = inodeMapNext(&map);
 
-		unsigned int blockAddr = inodeGetBlockAddr(inode, blockNum);
 		if (blockAddr == 0)
 		{
-			break;
+			if (runLeft == 0)
+			{
+				runAddr = allocateFileBlocks(vol, prevAddr ? prevAddr + numSectorsPerBlock : 0,
+				                             numBlocks - b, &runLeft);
+			}
+			if (runLeft == 0 || inodeAddBlock(inode, runAddr) != 0)
+			{
+				releaseBlockRun(vol, runAddr, runLeft);
+				inodeMapEnd(&map);
+				freeAsyncRequest(req);
+				return -1;
+			}
+			blockAddr = runAddr;
+			runAddr += numSectorsPerBlock;
+			runLeft--;
+			memset(blockData, 0, blockSize);
 		}
-
-		unsigned char blockData[blockSize];
-		unsigned int numSectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
-		for (unsigned int i = 0; i < numSectorsPerBlock; i++)
+		else if (blockStart < cursor || blockStart + blockSize > cursor + nbytes)
 		{
-			if (diskReadSector(disk, blockAddr + i, blockData + i * DISK_SECTORDATASIZE) != 0)
+			if (cacheReadSectors(disk, blockAddr, numSectorsPerBlock, blockData) != 0)
 			{
+				releaseBlockRun(vol, runAddr, runLeft);
+				inodeMapEnd(&map);
+				freeAsyncRequest(req);
 				return -1;
 			}
 		}
+		prevAddr = blockAddr;
 
-		unsigned int bytesFromBlock = blockSize - offsetInBlock;
-		if (bytesFromBlock > bytesToRead - totalRead)
-		{
-			bytesFromBlock = bytesToRead - totalRead;
-		}
+		cacheDiscard(disk, blockAddr, numSectorsPerBlock);
+		addAsyncRun(req, blockAddr, numSectorsPerBlock, blockData);
+	}
 
-		memcpy(buf + totalRead, blockData + offsetInBlock, bytesFromBlock);
-		totalRead += bytesFromBlock;
+	releaseBlockRun(vol, runAddr, runLeft);
+	inodeMapEnd(&map);
+
+	memcpy(req->data + cursor % blockSize, buf, nbytes);
+
+	int id = submitAsyncRequest(req, disk);
+	if (id < 0)
+	{
+		return -1;
 	}
 
-	fdTable[idx].cursor += totalRead;
+	fdTable[idx].cursor += nbytes;
+	if (fdTable[idx].cursor > inodeGetFileSize(inode))
+	{
+		inodeSetFileSize(inode, fdTable[idx].cursor);
+		inodeSave(inode);
+	}
+	flushVolumeIfDue(vol);
 
-	return totalRead;
+	return id;
 }
 
-int myFSWrite(int fd, const char *buf, unsigned int nbytes)
+int myFSWriteAsync(int fd, const char *buf, unsigned int nbytes)
 {
-	int idx = fd - 1;
+	Volume *vol = lockDescriptor(fd);
+	if (vol == NULL)
+	{
+		return -1;
+	}
 
-	if (idx < 0 || idx >= MAX_FDS || !fdTable[idx].used)
+	int ret = writeFileAsync(fd, buf, nbytes);
+	unlockVolume(vol);
+
+	return ret;
+}
+
+int myFSAsyncPoll(int req)
+{
+	int idx = req - 1;
+	int done;
+
+	if (idx < 0 || idx >= MYFS_MAX_AIOS)
 	{
 		return -1;
 	}
 
-	if (buf == NULL || nbytes == 0)
+	pthread_mutex_lock(&aioLock);
+	done = aioTable[idx].used ? aioTable[idx].pending == 0 : -1;
+	pthread_mutex_unlock(&aioLock);
+
+	return done;
+}
+
+int myFSAsyncWait(int req)
+{
+	int idx = req - 1;
+
+	if (idx < 0 || idx >= MYFS_MAX_AIOS)
 	{
 		return -1;
 	}
 
-	Inode *inode = fdTable[idx].inode;
-	Disk *disk = fdTable[idx].disk;
-	if (inode == NULL || disk == NULL)
+	pthread_mutex_lock(&aioLock);
+	if (!aioTable[idx].used)
 	{
+		pthread_mutex_unlock(&aioLock);
 		return -1;
 	}
+	while (aioTable[idx].pending > 0)
+	{
+		pthread_cond_wait(&aioDone, &aioLock);
+	}
+	pthread_mutex_unlock(&aioLock);
 
-	unsigned int cursor = fdTable[idx].cursor;
-	unsigned int totalWritten = 0;
-	unsigned int blockSize = sb.blockSize;
+	AsyncRequest *r = &aioTable[idx];
+	int ret = r->status != 0 ? -1 : (int)r->nbytes;
+	if (ret > 0 && !r->write)
+	{
+		memcpy(r->buf, r->data + r->offset, r->nbytes);
+	}
 
-	while (totalWritten < nbytes)
+	freeAsyncRequest(r);
+	return ret;
+}
+
+static int truncateFile(int fd, unsigned int size)
+{
+	int idx = fd - 1;
+
+	if (idx < 0 || idx >= MAX_FDS || !fdTable[idx].used)
 	{
-		unsigned int currentPos = cursor + totalWritten;
-		unsigned int blockNum = currentPos / blockSize;
-		unsigned int offsetInBlock = currentPos % blockSize;
+		return -1;
+	}
 
-		unsigned int blockAddr = inodeGetBlockAddr(inode, blockNum);
-		if (blockAddr == 0)
-		{
-			blockAddr = allocateFreeBlock(disk);
-			if (blockAddr == 0)
-			{
-				return -1;
-			}
+	Inode *inode = fdTable[idx].inode;
+	Volume *vol = fdTable[idx].volume;
+	if (inode == NULL || size > inodeGetFileSize(inode))
+	{
+		return -1;
+	}
 
-			if (inodeAddBlock(inode, blockAddr) != 0)
-			{
-				return -1;
-			}
-		}
+	unsigned int blockSize = vol->sb.blockSize;
+	if (truncateBlocks(vol, inode, (size + blockSize - 1) / blockSize) != 0)
+	{
+		return -1;
+	}
 
-		unsigned char blockData[blockSize];
-		unsigned int numSectorsPerBlock = blockSize / DISK_SECTORDATASIZE;
-		for (unsigned int i = 0; i < numSectorsPerBlock; i++)
+	inodeSetFileSize(inode, size);
+	inodeSave(inode);
+
+	pthread_mutex_lock(&fdLock);
+	for (int i = 0; i < MAX_FDS; i++)
+	{
+		if (fdTable[i].used && fdTable[i].volume == vol && fdTable[i].inodeNum == fdTable[idx].inodeNum)
 		{
-			if (diskReadSector(disk, blockAddr + i, blockData + i * DISK_SECTORDATASIZE) != 0)
+			if (fdTable[i].cursor > size)
 			{
-				return -1;
+				fdTable[i].cursor = size;
 			}
+			fdTable[i].lastReadEnd = 0;
+			fdTable[i].raWindow = 0;
+			fdTable[i].raNext = 0;
 		}
+	}
+	pthread_mutex_unlock(&fdLock);
+
+	flushVolumeIfDue(vol);
+	return 0;
+}
+
+int myFSTruncate(int fd, unsigned int size)
+{
+	Volume *vol = lockDescriptor(fd);
+	if (vol == NULL)
+	{
+		return -1;
+	}
+
+	int ret = truncateFile(fd, size);
+	unlockVolume(vol);
+
+	return ret;
+}
+
+static int closeFile(int fd)
+{
+	int idx = fd - 1;
+
+	if (idx < 0 || idx >= MAX_FDS)
+	{
+		return -1;
+	}
+
+	if (!fdTable[idx].used || fdTable[idx].isDir)
+	{
+		return -1;
+	}
+
+	waitAsyncRequests(fd);
+
+	if (fdTable[idx].inode != NULL)
+	{
+		inodeRelease(fdTable[idx].inode);
+	}
+
+	releaseDescriptor(idx);
+	return 0;
+}
+
+int myFSClose(int fd)
+{
+	Volume *vol = lockDescriptor(fd);
+	if (vol == NULL)
+	{
+		return -1;
+	}
 
-		unsigned int bytesToBlock = blockSize - offsetInBlock;
-		if (bytesToBlock > nbytes - totalWritten)
+	int ret = closeFile(fd);
+	unlockVolume(vol);
+
+	return ret;
+}
+
+int myFSSync(Disk *d)
+{
+	if (d == NULL)
+	{
+		Disk *disks[MYFS_MAX_VOLUMES];
+		pthread_mutex_lock(&volumesLock);
+		for (int i = 0; i < MYFS_MAX_VOLUMES; i++)
 		{
-			bytesToBlock = nbytes - totalWritten;
+			disks[i] = volumes[i].used ? volumes[i].disk : NULL;
 		}
+		pthread_mutex_unlock(&volumesLock);
 
-		memcpy(blockData + offsetInBlock, buf + totalWritten, bytesToBlock);
-
-		for (unsigned int i = 0; i < numSectorsPerBlock; i++)
+		for (int i = 0; i < MYFS_MAX_VOLUMES; i++)
 		{
-			if (diskWriteSector(disk, blockAddr + i, blockData + i * DISK_SECTORDATASIZE) != 0)
+			Volume *vol = disks[i] != NULL ? lockVolumeOf(disks[i]) : NULL;
+			if (vol == NULL)
+			{
+				continue;
+			}
+			int ret = inodeSync(vol->disk) != 0 || flushVolume(vol) != 0 ? -1 : 0;
+			unlockVolume(vol);
+			if (ret != 0)
 			{
 				return -1;
 			}
 		}
+		return cacheSyncAll();
+	}
 
-		totalWritten += bytesToBlock;
+	Volume *vol = lockVolumeOf(d);
+	if (vol == NULL)
+	{
+		return -1;
 	}
 
-	fdTable[idx].cursor += totalWritten;
+	int ret = syncVolume(vol);
+	unlockVolume(vol);
 
-	unsigned int newSize = fdTable[idx].cursor;
-	unsigned int oldSize = inodeGetFileSize(inode);
-	if (newSize > oldSize)
+	return ret;
+}
+
+int myFSOpenDir(Disk *d, const char *path)
+{
+	if (d == NULL || path == NULL || strcmp(path, "/") != 0)
 	{
-		inodeSetFileSize(inode, newSize);
-		inodeSave(inode);
+		return -1;
 	}
 
-	return totalWritten;
+	Volume *vol = lockVolumeOf(d);
+	if (vol == NULL)
+	{
+		return -1;
+	}
+
+	int idx = allocDescriptor(vol, 1);
+	unlockVolume(vol);
+
+	return idx < 0 ? -1 : idx + 1;
 }
 
-int myFSClose(int fd)
+static int readDir(int fd, char *filename, unsigned int *inumber)
 {
 	int idx = fd - 1;
 
-	if (idx < 0 || idx >= MAX_FDS)
+	if (idx < 0 || idx >= MAX_FDS || !fdTable[idx].used || !fdTable[idx].isDir)
 	{
 		return -1;
 	}
 
-	if (!fdTable[idx].used)
+	if (filename == NULL || inumber == NULL)
 	{
 		return -1;
 	}
 
-	if (fdTable[idx].inode != NULL)
+	Volume *vol = fdTable[idx].volume;
+	if (fdTable[idx].cursor >= vol->numFileEntries)
 	{
-		free(fdTable[idx].inode);
-		fdTable[idx].inode = NULL;
+		return 0;
 	}
 
-	fdTable[idx].used = 0;
-	fdTable[idx].disk = NULL;
-	fdTable[idx].inodeNum = 0;
-	fdTable[idx].cursor = 0;
-
-	return 0;
+	FileEntry *entry = &vol->fileTable[fdTable[idx].cursor++];
+	strcpy(filename, entry->path + 1);
+	*inumber = entry->inodeNum;
+	return 1;
 }
 
-int myFSOpenDir(Disk *d, const char *path)
+int myFSReadDir(int fd, char *filename, unsigned int *inumber)
 {
-	(void)d;
-	(void)path;
-	return -1;
+	Volume *vol = lockDescriptor(fd);
+	if (vol == NULL)
+	{
+		return -1;
+	}
+
+	int ret = readDir(fd, filename, inumber);
+	unlockVolume(vol);
+
+	return ret;
 }
 
-int myFSReadDir(int fd, char *filename, unsigned int *inumber)
+int myFSLink(int fd, const char *filename, unsigned int inumber)
 {
 	(void)fd;
 	(void)filename;
@@ -650,25 +2469,95 @@ int myFSReadDir(int fd, char *filename, unsigned int *inumber)
 	return -1;
 }
 
-int myFSLink(int fd, const char *filename, unsigned int inumber)
+static int unlinkFile(int fd, const char *filename)
 {
-	(void)fd;
-	(void)filename;
-	(void)inumber;
-	return -1;
+	int idx = fd - 1;
+
+	if (idx < 0 || idx >= MAX_FDS || !fdTable[idx].used || !fdTable[idx].isDir || filename == NULL)
+	{
+		return -1;
+	}
+
+	char path[MAX_FILENAME_LENGTH + 2];
+	if (filename[0] != '/')
+	{
+		if (strlen(filename) + 1 > MAX_FILENAME_LENGTH)
+		{
+			return -1;
+		}
+		path[0] = '/';
+		strcpy(path + 1, filename);
+		filename = path;
+	}
+
+	Volume *vol = fdTable[idx].volume;
+	int entryIdx = findFileEntry(vol, filename);
+	if (entryIdx < 0)
+	{
+		return -1;
+	}
+
+	unsigned int inodeNum = vol->fileTable[entryIdx].inodeNum;
+	int inUse = 0;
+	pthread_mutex_lock(&fdLock);
+	for (int i = 0; i < MAX_FDS; i++)
+	{
+		if (fdTable[i].used && fdTable[i].volume == vol && fdTable[i].inodeNum == inodeNum)
+		{
+			inUse = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fdLock);
+
+	if (inUse || deleteFile(vol, inodeNum) != 0)
+	{
+		return -1;
+	}
+
+	vol->fileTable[entryIdx] = vol->fileTable[--vol->numFileEntries];
+	return 0;
 }
 
 int myFSUnlink(int fd, const char *filename)
 {
-	(void)fd;
-	(void)filename;
-	return -1;
+	Volume *vol = lockDescriptor(fd);
+	if (vol == NULL)
+	{
+		return -1;
+	}
+
+	int ret = unlinkFile(fd, filename);
+	unlockVolume(vol);
+
+	return ret;
+}
+
+static int closeDir(int fd)
+{
+	int idx = fd - 1;
+
+	if (idx < 0 || idx >= MAX_FDS || !fdTable[idx].used || !fdTable[idx].isDir)
+	{
+		return -1;
+	}
+
+	releaseDescriptor(idx);
+	return 0;
 }
 
 int myFSCloseDir(int fd)
 {
-	(void)fd;
-	return -1;
+	Volume *vol = lockDescriptor(fd);
+	if (vol == NULL)
+	{
+		return -1;
+	}
+
+	int ret = closeDir(fd);
+	unlockVolume(vol);
+
+	return ret;
 }
 
 static FSInfo myFSInfo;
@@ -683,12 +2572,14 @@ int installMyFS(void)
 	myFSInfo.openFn = myFSOpen;
 	myFSInfo.readFn = myFSRead;
 	myFSInfo.writeFn = myFSWrite;
+	myFSInfo.truncateFn = myFSTruncate;
 	myFSInfo.closeFn = myFSClose;
 	myFSInfo.opendirFn = myFSOpenDir;
 	myFSInfo.readdirFn = myFSReadDir;
 	myFSInfo.linkFn = myFSLink;
 	myFSInfo.unlinkFn = myFSUnlink;
 	myFSInfo.closedirFn = myFSCloseDir;
+	myFSInfo.syncFn = myFSSync;
 
 	int slot = vfsRegisterFS(&myFSInfo);
 	if (slot < 0)
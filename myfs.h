@@ -20,4 +20,33 @@
 //Caso contrario, retorna -1
 int installMyFS ( void );
 
+//Funcao que reduz para size bytes o arquivo aberto no descritor fd,
+//devolvendo ao sistema de arquivos os blocos alem do novo tamanho. Cursores
+//alem do novo fim do arquivo sao trazidos para ele. Retorna 0 se bem sucedida
+//ou -1 caso contrario (inclusive se size for maior que o tamanho atual)
+int myFSTruncate (int fd, unsigned int size);
+
+//Funcao que inicia a leitura assincrona de ate' nbytes do arquivo aberto no
+//descritor fd, a partir do cursor, para buf. Setores presentes na cache sao
+//copiados de imediato; os demais sao submetidos ao disco de uma vez, sem
+//aguardar gravacoes pendentes. O cursor avanca imediatamente e buf nao deve
+//ser usado ate' a conclusao. Retorna o identificador (> 0) da requisicao ou
+//-1 em erro
+int myFSReadAsync (int fd, char *buf, unsigned int nbytes);
+
+//Funcao que inicia a escrita assincrona de nbytes de buf no arquivo aberto no
+//descritor fd, a partir do cursor. Blocos e tamanho do arquivo sao atualizados
+//de imediato; os dados sao copiados, podendo buf ser reutilizado logo apos o
+//retorno. Retorna o identificador (> 0) da requisicao ou -1 em erro
+int myFSWriteAsync (int fd, const char *buf, unsigned int nbytes);
+
+//Funcao que retorna, sem bloquear, 1 se a requisicao assincrona req foi
+//concluida, 0 se ainda esta' pendente ou -1 se req nao existir
+int myFSAsyncPoll (int req);
+
+//Funcao que aguarda a conclusao da requisicao assincrona req e a libera.
+//Retorna o numero de bytes transferidos ou -1 em erro. O fechamento de um
+//descritor aguarda suas requisicoes, mas nao as libera
+int myFSAsyncWait (int req);
+
 #endif
@@ -11,15 +11,24 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include "util.h"
 
+//Plataformas little-endian com unsigned int de 4 bytes armazenam os inteiros
+//em memoria exatamente como no disco, e a conversao se reduz a uma copia
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) \
+    && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && __SIZEOF_INT__ == 4
+#define UTIL_NATIVELE 1
+#else
+#define UTIL_NATIVELE 0
+#endif
+
 //Funcao para a conversao de unsigned int para um array de bytes (char[])
 //O array c deve possuir numero de elementos suficiente para abrigar um 
 //unsigned int como sequencia de bytes. Ex.: Em plataformas de 64 bits testadas
 //unsigned int possui 4 bytes, neste caso c deve possuir 4 elementos
 void ul2char (unsigned int ui, unsigned char *c) {
-	for (int i = 0; i < sizeof (unsigned int); i++) 
-		c[i] = (ui >> (i*8)) & 0xFF;
+	ul2charArray (&ui, 1, c);
 }
 
 //Funcao para a conversao de um array de bytes (char[]) em um unsigned int
@@ -28,7 +37,62 @@ void ul2char (unsigned int ui, unsigned char *c) {
 //testadas unsigned int possui 4 bytes, neste caso apenas os 4 primeiros
 //elementos de c serao considerados
 void char2ul (unsigned char *c, unsigned int *ui) {
-	*ui = 0;
-	for (int i = 0; i < sizeof (unsigned int); i++)
-		*ui = *ui + (c[i] << (i*8));
+	char2ulArray (c, 1, ui);
+}
+
+//Funcao para a conversao de n unsigned int (ui) para uma sequencia de bytes
+//(c) em little-endian, UTIL_WORDSIZE bytes por valor
+void ul2charArray (const unsigned int *ui, unsigned long n, unsigned char *c) {
+#if UTIL_NATIVELE
+	memcpy (c, ui, n * UTIL_WORDSIZE);
+#else
+	for (unsigned long i = 0; i < n; i++) {
+		c[i*UTIL_WORDSIZE] = ui[i] & 0xFF;
+		c[i*UTIL_WORDSIZE+1] = (ui[i] >> 8) & 0xFF;
+		c[i*UTIL_WORDSIZE+2] = (ui[i] >> 16) & 0xFF;
+		c[i*UTIL_WORDSIZE+3] = (ui[i] >> 24) & 0xFF;
+	}
+#endif
+}
+
+//Funcao para a conversao de uma sequencia de bytes (c) em little-endian para
+//n unsigned int (ui). Os vetores c e ui nao devem se sobrepor
+void char2ulArray (const unsigned char *c, unsigned long n, unsigned int *ui) {
+#if UTIL_NATIVELE
+	memcpy (ui, c, n * UTIL_WORDSIZE);
+#else
+	for (unsigned long i = 0; i < n; i++)
+		ui[i] = (unsigned int) c[i*UTIL_WORDSIZE]
+		        | ((unsigned int) c[i*UTIL_WORDSIZE+1] << 8)
+		        | ((unsigned int) c[i*UTIL_WORDSIZE+2] << 16)
+		        | ((unsigned int) c[i*UTIL_WORDSIZE+3] << 24);
+#endif
+}
+
+//Funcao para a conversao de n unsigned long long (ull) para uma sequencia de
+//bytes (c) em little-endian, 8 bytes por valor
+void ull2charArray (const unsigned long long *ull, unsigned long n,
+                    unsigned char *c) {
+#if UTIL_NATIVELE
+	memcpy (c, ull, n * 8);
+#else
+	for (unsigned long i = 0; i < n; i++)
+		for (int b = 0; b < 8; b++)
+			c[i*8+b] = (ull[i] >> (b*8)) & 0xFF;
+#endif
+}
+
+//Funcao para a conversao de uma sequencia de bytes (c) em little-endian para
+//n unsigned long long (ull). Os vetores c e ull nao devem se sobrepor
+void char2ullArray (const unsigned char *c, unsigned long n,
+                    unsigned long long *ull) {
+#if UTIL_NATIVELE
+	memcpy (ull, c, n * 8);
+#else
+	for (unsigned long i = 0; i < n; i++) {
+		ull[i] = 0;
+		for (int b = 0; b < 8; b++)
+			ull[i] |= (unsigned long long) c[i*8+b] << (b*8);
+	}
+#endif
 }
@@ -13,6 +13,9 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+//Numero de bytes ocupados em disco por um unsigned int codificado
+#define UTIL_WORDSIZE 4
+
 //Funcao para a conversao de unsigned int para um array de bytes (char[])
 //O array c deve possuir numero de elementos suficiente para abrigar um 
 //unsigned int como sequencia de bytes. Ex.: Em plataformas de 64 bits testadas
@@ -26,4 +29,24 @@ void ul2char (unsigned int ui, unsigned char *c);
 //elementos de c serao considerados
 void char2ul (unsigned char *c, unsigned int *ui);
 
+//Funcao para a conversao de n unsigned int (ui) para uma sequencia de bytes
+//(c) em little-endian, UTIL_WORDSIZE bytes por valor. Em plataformas
+//little-endian a conversao e' uma unica copia; nas demais, um laco sem
+//dependencias entre valores, vetorizavel pelo compilador
+void ul2charArray (const unsigned int *ui, unsigned long n, unsigned char *c);
+
+//Funcao para a conversao de uma sequencia de bytes (c) em little-endian para
+//n unsigned int (ui). Os vetores c e ui nao devem se sobrepor
+void char2ulArray (const unsigned char *c, unsigned long n, unsigned int *ui);
+
+//Funcao para a conversao de n unsigned long long (ull) para uma sequencia de
+//bytes (c) em little-endian, 8 bytes por valor
+void ull2charArray (const unsigned long long *ull, unsigned long n,
+                    unsigned char *c);
+
+//Funcao para a conversao de uma sequencia de bytes (c) em little-endian para
+//n unsigned long long (ull). Os vetores c e ull nao devem se sobrepor
+void char2ullArray (const unsigned char *c, unsigned long n,
+                    unsigned long long *ull);
+
 #endif
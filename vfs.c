@@ -11,14 +11,34 @@
 */
 
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 #include "vfs.h"
 #include "inode.h"
 
 #define MAX_INSTALLED_FS 4
 
+//Entrada da tabela de pontos de montagem
+typedef struct mount {
+	char prefix[MAX_FILENAME_LENGTH+1];	//Ponto de montagem ("/", "/mnt/a")
+	Disk *d;				//Disco montado (NULL: entrada livre)
+	FSInfo *fs;				//Sistema de arquivos do disco
+} Mount;
+
+//Descritor de arquivo do VFS, traduzido para o descritor do FS que o abriu
+typedef struct vfs_fd {
+	Mount *mount;	//Ponto de montagem do arquivo (NULL: descritor livre)
+	int fsFd;	//Descritor devolvido pelo sistema de arquivos
+} VFSFd;
+
 FSInfo* installedFSInfo[MAX_INSTALLED_FS];
-Disk* rootDisk;
-FSInfo* rootFS;
+Mount mounts[MAX_MOUNTS];
+VFSFd vfsFds[MAX_FDS];
+
+//Exclusao mutua sobre a tabela de pontos de montagem e os descritores do VFS.
+//Nao e' mantida durante leituras e escritas, que sao atendidas diretamente
+//pelo sistema de arquivos de cada disco, concorrentemente
+static pthread_mutex_t vfsLock = PTHREAD_MUTEX_INITIALIZER;
 
 //Funcao interna para a obtencao do FSInfo correspondente a um fsId
 FSInfo* __vfsGetFSInfo (char fsId) {
@@ -33,47 +53,228 @@ FSInfo* __vfsGetFSInfo (char fsId) {
 	return fsInfo;
 }
 
+//Funcao interna que retorna a entrada montada exatamente em prefix, ou NULL
+Mount* __vfsFindMount (const char *prefix) {
+	for (int i = 0; i < MAX_MOUNTS; i++)
+		if ( mounts[i].d && strcmp (mounts[i].prefix, prefix) == 0 )
+			return &mounts[i];
+	return NULL;
+}
+
+//Funcao interna que retorna o ponto de montagem que atende path, escolhido
+//pelo prefixo mais longo que termina em uma fronteira de componente. Em *rel
+//e' devolvido o caminho a ser passado ao sistema de arquivos: o proprio path
+//para a raiz e o restante do caminho ("/" se vazio) para os demais pontos
+Mount* __vfsRoute (const char *path, const char **rel) {
+	Mount *best = NULL;
+	size_t bestLen = 0;
+	for (int i = 0; i < MAX_MOUNTS; i++) {
+		size_t len;
+		if ( !mounts[i].d ) continue;
+		if ( strcmp (mounts[i].prefix, "/") == 0 ) {
+			if ( !best ) best = &mounts[i];
+			continue;
+		}
+		len = strlen (mounts[i].prefix);
+		if ( len <= bestLen ) continue;
+		if ( strncmp (path, mounts[i].prefix, len) != 0 ) continue;
+		if ( path[len] != '/' && path[len] != '\0' ) continue;
+		best = &mounts[i];
+		bestLen = len;
+	}
+	if ( !best ) return NULL;
+	if ( !bestLen ) *rel = path;
+	else *rel = path[bestLen] ? path + bestLen : "/";
+	return best;
+}
+
+//Funcao interna que associa um descritor do FS a um descritor do VFS.
+//Retorna o descritor do VFS (iniciando em 1) ou -1 se nao houver descritores
+//livres
+int __vfsAllocFd (Mount *m, int fsFd) {
+	int fd = -1;
+	pthread_mutex_lock (&vfsLock);
+	for (int i = 0; i < MAX_FDS; i++)
+		if ( !vfsFds[i].mount ) {
+			vfsFds[i].mount = m;
+			vfsFds[i].fsFd = fsFd;
+			fd = i + 1;
+			break;
+		}
+	pthread_mutex_unlock (&vfsLock);
+	return fd;
+}
+
+//Funcao interna que libera um descritor do VFS
+void __vfsFreeFd (VFSFd *f) {
+	pthread_mutex_lock (&vfsLock);
+	f->mount = NULL;
+	pthread_mutex_unlock (&vfsLock);
+}
+
+//Funcao interna que verifica se um disco esta' montado, com a exclusao mutua
+//sobre a tabela de pontos de montagem ja' obtida
+int __vfsDiskIsMounted (Disk *d) {
+	for (int i = 0; i < MAX_MOUNTS; i++)
+		if ( d && mounts[i].d == d ) return 1;
+	return 0;
+}
+
+//Funcao interna que retorna o descritor do VFS correspondente a fd, ou NULL
+//se fd nao estiver em uso
+VFSFd* __vfsGetFd (int fd) {
+	if ( fd < 1 || fd > MAX_FDS || !vfsFds[fd-1].mount ) return NULL;
+	return &vfsFds[fd-1];
+}
+
 //Funcao para inicializacao do sistema de arquivos virtual
 void vfsInit ( void ) {
 	for (int i=0; i<MAX_INSTALLED_FS; i++)
 		installedFSInfo[i] = NULL;
-	rootDisk = NULL;
-	rootFS = NULL;	
+	memset (mounts, 0, sizeof (mounts));
+	memset (vfsFds, 0, sizeof (vfsFds));
 }
 
 //Funcao para a montagem do sistema de arquivos que sera' a raiz da arvore
 //unica do sistema (Unix-like). Retorna 0 caso bem sucedido e -1 em contrario
 int vfsMountRoot (Disk *d, char fsId) {
-	if ( !d ) return -1;
-	rootFS = __vfsGetFSInfo (fsId);
-	if ( !rootFS ) return -1;
-	if ( !rootFS->xMountFn (d, 1) ) return -1;
-	rootDisk = d;
-	return 0;
+	return vfsMount (d, fsId, "/");
 }
 
 //Funcao para a desmontagem do sistema de arquivos. Nao podem haver arquivos
 //ou diretorios abertos para a desmontagem. Retorna 0 caso bem sucedido e -1
 //caso contrario
 int vfsUnmountRoot ( void ) {
-	if ( !rootDisk || !rootFS ) return -1;
-	if ( !rootFS->isidleFn (rootDisk) ) return -1;
-	if ( !rootFS->xMountFn (rootDisk, 0) ) return -1;
-	rootFS = NULL;
-	rootDisk = NULL;
+	return vfsUnmount ("/");
+}
+
+//Funcao interna que executa vfsMount, com a exclusao mutua ja' obtida
+int __vfsMount (Disk *d, char fsId, const char *prefix) {
+	char norm[MAX_FILENAME_LENGTH+1];
+	size_t len;
+	FSInfo *fs;
+	Mount *m = NULL;
+	if ( !d || !prefix || prefix[0] != '/' ) return -1;
+	len = strlen (prefix);
+	if ( len > MAX_FILENAME_LENGTH ) return -1;
+	strcpy (norm, prefix);
+	while ( len > 1 && norm[len-1] == '/' ) norm[--len] = '\0';
+	if ( __vfsFindMount (norm) || __vfsDiskIsMounted (d) ) return -1;
+	//Demais pontos de montagem pertencem 'a arvore da raiz
+	if ( strcmp (norm, "/") != 0 && !__vfsFindMount ("/") ) return -1;
+	fs = __vfsGetFSInfo (fsId);
+	if ( !fs ) return -1;
+	for (int i = 0; i < MAX_MOUNTS; i++)
+		if ( !mounts[i].d ) {
+			m = &mounts[i];
+			break;
+		}
+	if ( !m ) return -1;
+	if ( !fs->xMountFn (d, 1) ) return -1;
+	strcpy (m->prefix, norm);
+	m->fs = fs;
+	m->d = d;
 	return 0;
 }
 
+//Funcao para a montagem do sistema de arquivos de um disco no ponto de
+//montagem indicado por prefix. Retorna 0 caso bem sucedido e -1 em contrario
+int vfsMount (Disk *d, char fsId, const char *prefix) {
+	int ret;
+	pthread_mutex_lock (&vfsLock);
+	ret = __vfsMount (d, fsId, prefix);
+	pthread_mutex_unlock (&vfsLock);
+	return ret;
+}
+
+//Funcao interna que executa vfsUnmount, com a exclusao mutua ja' obtida
+int __vfsUnmount (const char *prefix) {
+	Mount *m;
+	if ( !prefix ) return -1;
+	m = __vfsFindMount (prefix);
+	if ( !m ) return -1;
+	//A raiz so' pode ser desmontada apos os demais pontos de montagem
+	if ( strcmp (m->prefix, "/") == 0 )
+		for (int i = 0; i < MAX_MOUNTS; i++)
+			if ( mounts[i].d && &mounts[i] != m ) return -1;
+	for (int i = 0; i < MAX_FDS; i++)
+		if ( vfsFds[i].mount == m ) return -1;
+	if ( !m->fs->isidleFn (m->d) ) return -1;
+	if ( !m->fs->xMountFn (m->d, 0) ) return -1;
+	m->d = NULL;
+	m->fs = NULL;
+	m->prefix[0] = '\0';
+	return 0;
+}
+
+//Funcao para a desmontagem do sistema de arquivos montado em prefix. Retorna
+//0 caso bem sucedido e -1 caso contrario
+int vfsUnmount (const char *prefix) {
+	int ret;
+	pthread_mutex_lock (&vfsLock);
+	ret = __vfsUnmount (prefix);
+	pthread_mutex_unlock (&vfsLock);
+	return ret;
+}
+
+//Funcao para a desmontagem de todos os pontos de montagem, exceto a raiz.
+//Retorna 0 caso todos tenham sido desmontados e -1 caso contrario
+int vfsUnmountAll ( void ) {
+	int ret = 0;
+	pthread_mutex_lock (&vfsLock);
+	for (int i = 0; i < MAX_MOUNTS; i++) {
+		if ( !mounts[i].d || strcmp (mounts[i].prefix, "/") == 0 )
+			continue;
+		if ( __vfsUnmount (mounts[i].prefix) < 0 ) ret = -1;
+	}
+	pthread_mutex_unlock (&vfsLock);
+	return ret;
+}
+
+//Funcao que verifica se um disco esta' montado em algum ponto de montagem.
+//Retorna 1 se montado e 0 caso contrario
+int vfsDiskIsMounted (Disk *d) {
+	int ret;
+	pthread_mutex_lock (&vfsLock);
+	ret = __vfsDiskIsMounted (d);
+	pthread_mutex_unlock (&vfsLock);
+	return ret;
+}
+
+//Funcao para gravar no disco os dados pendentes de todos os sistemas de
+//arquivos montados. Cada tipo de sistema de arquivos e' sincronizado uma
+//unica vez, para todos os seus discos, de modo que estes sejam atendidos em
+//paralelo. Retorna 0 caso bem sucedido e -1 caso contrario
+int vfsSync ( void ) {
+	int ret = 0;
+	pthread_mutex_lock (&vfsLock);
+	for (int i = 0; i < MAX_INSTALLED_FS; i++) {
+		int used = 0;
+		if ( !installedFSInfo[i] || !installedFSInfo[i]->syncFn )
+			continue;
+		for (int m = 0; m < MAX_MOUNTS; m++)
+			if ( mounts[m].d && mounts[m].fs == installedFSInfo[i] )
+				used = 1;
+		if ( used && installedFSInfo[i]->syncFn (NULL) < 0 ) ret = -1;
+	}
+	pthread_mutex_unlock (&vfsLock);
+	return ret;
+}
+
 //Funcao para formatacao de um disco com o sistema de arquivos indicado pelo
 //identificador do sistema de arquivos (fsId), com tamanho de blocos igual a
 //blockSize. Retorna o numero total de blocos disponiveis no disco, se
 //formatado com sucesso. Caso contrario, retorna -1.
 int vfsFormat (Disk *d, unsigned int blockSize, char fsId) {
 	FSInfo *fsInfo = NULL;
+	int ret = -1;
 	if ( !d ) return -1;
+	pthread_mutex_lock (&vfsLock);
 	fsInfo = __vfsGetFSInfo (fsId);
-	if ( !fsInfo ) return -1;
-	return fsInfo->formatFn (d, blockSize);
+	if ( fsInfo && !__vfsDiskIsMounted (d) )
+		ret = fsInfo->formatFn (d, blockSize);
+	pthread_mutex_unlock (&vfsLock);
+	return ret;
 }
 
 //Funcao para abertura de um arquivo, a partir do caminho especificado em path,
@@ -81,8 +282,25 @@ int vfsFormat (Disk *d, unsigned int blockSize, char fsId) {
 //arquivo, em caso de sucesso. Retorna -1, caso contrario.
 //Descritores de arquivo se iniciam em 1
 int vfsOpen (const char *path) {
-	if ( !rootDisk || !rootFS ) return -1;
-	return rootFS->openFn (rootDisk, path);
+	const char *rel;
+	Mount *m;
+	FSInfo *fs = NULL;
+	Disk *d = NULL;
+	int fsFd, fd;
+	if ( !path ) return -1;
+	pthread_mutex_lock (&vfsLock);
+	m = __vfsRoute (path, &rel);
+	if ( m ) {
+		fs = m->fs;
+		d = m->d;
+	}
+	pthread_mutex_unlock (&vfsLock);
+	if ( !m ) return -1;
+	fsFd = fs->openFn (d, rel);
+	if ( fsFd < 0 ) return -1;
+	fd = __vfsAllocFd (m, fsFd);
+	if ( fd < 0 ) fs->closeFn (fsFd);
+	return fd;
 }
 
 //Funcao para a leitura de um arquivo, a partir de um descritor de arquivo
@@ -90,8 +308,9 @@ int vfsOpen (const char *path) {
 //nbytes. Retorna o numero de bytes efetivamente lidos em caso de sucesso ou
 //-1, caso contrario.
 int vfsRead (int fd, char *buf, unsigned int nbytes) {
-	if ( !rootDisk || !rootFS ) return -1;
-	return rootFS->readFn (fd, buf, nbytes);
+	VFSFd *f = __vfsGetFd (fd);
+	if ( !f ) return -1;
+	return f->mount->fs->readFn (f->fsFd, buf, nbytes);
 }
 
 //Funcao para a escrita de um arquivo, a partir de um descritor de arquivo
@@ -99,23 +318,53 @@ int vfsRead (int fd, char *buf, unsigned int nbytes) {
 //maximo de nbytes. Retorna o numero de bytes efetivamente escritos em caso
 //de sucesso ou -1, caso contrario
 int vfsWrite (int fd, const char *buf, unsigned int nbytes) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->writeFn (fd, buf, nbytes);
+        VFSFd *f = __vfsGetFd (fd);
+        if ( !f ) return -1;
+        return f->mount->fs->writeFn (f->fsFd, buf, nbytes);
+}
+
+//Funcao para reduzir para size bytes um arquivo, a partir de um descritor de
+//arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso contrario
+//(inclusive se o sistema de arquivos nao suportar a operacao)
+int vfsTruncate (int fd, unsigned int size) {
+        VFSFd *f = __vfsGetFd (fd);
+        if ( !f || !f->mount->fs->truncateFn ) return -1;
+        return f->mount->fs->truncateFn (f->fsFd, size);
 }
 
 //Funcao para fechar um arquivo, a partir de um descritor de arquivo existente.
 //Retorna 0 caso bem sucedido, ou -1 caso contrario
 int vfsClose (int fd) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->closeFn (fd);
+        VFSFd *f = __vfsGetFd (fd);
+        if ( !f ) return -1;
+        if ( f->mount->fs->closeFn (f->fsFd) < 0 ) return -1;
+        __vfsFreeFd (f);
+        return 0;
 }
 
 //Funcao para abertura de um diretorio, a partir do caminho especificado em
 //path, no modo Read/Write, criando o diretorio se nao existir. Retorna um
 //descritor de arquivo, em caso de sucesso. Retorna -1, caso contrario.
 int vfsOpendir (const char *path) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->opendirFn (rootDisk, path);
+        const char *rel;
+        Mount *m;
+        int fsFd, fd;
+        FSInfo *fs = NULL;
+        Disk *d = NULL;
+        if ( !path ) return -1;
+        pthread_mutex_lock (&vfsLock);
+        m = __vfsRoute (path, &rel);
+        if ( m ) {
+                fs = m->fs;
+                d = m->d;
+        }
+        pthread_mutex_unlock (&vfsLock);
+        if ( !m ) return -1;
+        fsFd = fs->opendirFn (d, rel);
+        if ( fsFd < 0 ) return -1;
+        fd = __vfsAllocFd (m, fsFd);
+        if ( fd < 0 ) fs->closedirFn (fsFd);
+        return fd;
 }
 
 //Funcao para a leitura de um diretorio, identificado por um descritor de
@@ -125,8 +374,9 @@ int vfsOpendir (const char *path) {
 //correspondente 'a entrada e' copiado para inumber. Retorna 1 se uma entrada
 //foi lida, 0 se fim do diretorio ou -1 caso mal sucedido.
 int vfsReaddir (int fd, char *filename, unsigned int *inumber) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->readdirFn (fd, filename, inumber);
+        VFSFd *f = __vfsGetFd (fd);
+        if ( !f ) return -1;
+        return f->mount->fs->readdirFn (f->fsFd, filename, inumber);
 }
 
 //Funcao para adicionar uma entrada a um diretorio, identificado por um 
@@ -134,23 +384,28 @@ int vfsReaddir (int fd, char *filename, unsigned int *inumber) {
 //filename e apontara' para o numero de i-node indicado por inumber. Retorna 0\
 //caso bem sucedido, ou -1 caso contrario.
 int vfsLink (int fd, const char *filename, unsigned int inumber) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->linkFn (fd, filename, inumber);
+        VFSFd *f = __vfsGetFd (fd);
+        if ( !f ) return -1;
+        return f->mount->fs->linkFn (f->fsFd, filename, inumber);
 }
 
 //Funcao para remover uma entrada existente em um diretorio, este identificado
 //por um descritor de arquivo existente. A entrada e' identificada pelo nome 
 //indicado em filename. Retorna 0 caso bem sucedido, ou -1 caso contrario.
 int vfsUnlink (int fd, const char *filename) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->unlinkFn (fd, filename);
+        VFSFd *f = __vfsGetFd (fd);
+        if ( !f ) return -1;
+        return f->mount->fs->unlinkFn (f->fsFd, filename);
 }
 
 //Funcao para fechar um diretorio, identificado por um descritor de arquivo
 //existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.
 int vfsClosedir (int fd) {
-        if ( !rootDisk || !rootFS ) return -1;
-        return rootFS->closedirFn (fd);
+        VFSFd *f = __vfsGetFd (fd);
+        if ( !f ) return -1;
+        if ( f->mount->fs->closedirFn (f->fsFd) < 0 ) return -1;
+        __vfsFreeFd (f);
+        return 0;
 }
 
 //Registra novo sistema de arquivos. Retorna um identificador unico (slot),
@@ -171,15 +426,23 @@ int vfsRegisterFS (FSInfo* fsInfo) {
 //nao pode ter seu registro desfeito. Retorna 0 se bem sucedido e -1 caso
 //contrario
 int vfsUnregisterFS(char fsId) {
-	if (fsId == rootFS->fsid) return -1;
+	int ret = -1;
+	pthread_mutex_lock (&vfsLock);
+	for (int i=0; i<MAX_MOUNTS; i++)
+		if ( mounts[i].d && mounts[i].fs->fsid == fsId ) {
+			pthread_mutex_unlock (&vfsLock);
+			return -1;
+		}
 	for (int i=0; i<MAX_INSTALLED_FS; i++) {
 		if ( !installedFSInfo[i] ) continue;
 		if ( fsId == installedFSInfo[i]->fsid ) {
 			installedFSInfo[i] = NULL;
-			return 0;
+			ret = 0;
+			break;
 		}
 	}
-	return -1;
+	pthread_mutex_unlock (&vfsLock);
+	return ret;
 }
 
 //Escreve na saida padrao as informacoes sobre sistemas de arquivos registrados
@@ -195,3 +458,32 @@ void vfsDumpFSInfo (void) {
 	if (noFS) printf ("\n!! FSInfo: No file systems supported\n");
 }
 
+//Escreve na saida padrao a tabela de pontos de montagem
+void vfsDumpMounts (void) {
+	int noMounts = 1;
+	pthread_mutex_lock (&vfsLock);
+	for (int i=0; i<MAX_MOUNTS; i++)
+		if ( mounts[i].d ) {
+			noMounts = 0;
+			printf ("\n-- Mount: %s; Disk ID: %d; FS Name: %s\n",
+					mounts[i].prefix, diskGetId (mounts[i].d),
+					mounts[i].fs->fsname);
+		}
+	pthread_mutex_unlock (&vfsLock);
+	if (noMounts) printf ("\n!! Mount: No file systems mounted\n");
+}
+
+//Escreve na saida padrao os contadores de E/S e os histogramas de latencia
+//dos discos montados
+void vfsDumpDiskStats (void) {
+	int noMounts = 1;
+	pthread_mutex_lock (&vfsLock);
+	for (int i=0; i<MAX_MOUNTS; i++)
+		if ( mounts[i].d ) {
+			noMounts = 0;
+			printf ("\n-- Mount: %s\n", mounts[i].prefix);
+			diskDumpStats (mounts[i].d);
+		}
+	pthread_mutex_unlock (&vfsLock);
+	if (noMounts) printf ("\n!! DiskStats: No file systems mounted\n");
+}
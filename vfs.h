@@ -17,6 +17,7 @@
 
 #define MAX_FDS 128             //Numero maximo de descritores de arquivos
 #define MAX_FILENAME_LENGTH 255 //Comprimento maximo do nome de arquivos
+#define MAX_MOUNTS 8            //Numero maximo de sistemas de arquivos montados
 
 #define FILETYPE_DIR 128    //Identificador de tipo de arquivo: diretorio
 #define FILETYPE_REGULAR 64 //Identificador de tipo de arquivo: arq regular
@@ -65,6 +66,12 @@ typedef struct fs_info {
 	//efetivamente escritos em caso de sucesso ou -1, caso contrario
 	int (*writeFn) (int fd, const char *buf, unsigned int nbytes);
 
+	//Funcao para reduzir para size bytes um arquivo, a partir de um
+	//descritor de arquivo existente, liberando os blocos alem do novo
+	//tamanho. Retorna 0 caso bem sucedido, ou -1 caso contrario (inclusive
+	//se size for maior que o tamanho atual). Pode ser NULL
+	int (*truncateFn) (int fd, unsigned int size);
+
 	//Funcao para fechar um arquivo, a partir de um descritor de arquivo
 	//existente. Retorna 0 caso bem sucedido, ou -1 caso contrario
 	int (*closeFn) (int fd);
@@ -100,6 +107,11 @@ typedef struct fs_info {
 	//arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.	
 	int (*closedirFn) (int fd);
 
+	//Funcao para gravar no disco d os dados pendentes de gravacao do
+	//sistema de arquivos montado, ou de todos os discos montados se d for
+	//NULL. Retorna 0 caso bem sucedido, ou -1 caso contrario.
+	int (*syncFn) (Disk *d);
+
 } FSInfo;
 
 //Funcao para inicializacao do sistema de arquivos virtual
@@ -114,6 +126,32 @@ int vfsMountRoot (Disk *d, char fsId);
 //caso contrario
 int vfsUnmountRoot ( void );
 
+//Funcao para a montagem do sistema de arquivos de um disco no ponto de
+//montagem indicado por prefix (caminho absoluto, p.ex. "/mnt/a"). A raiz
+//("/") deve ser montada antes dos demais pontos. Caminhos que comecem por
+//prefix passam a ser atendidos por este disco, prevalecendo o ponto de
+//montagem mais longo. Retorna 0 caso bem sucedido e -1 em contrario
+int vfsMount (Disk *d, char fsId, const char *prefix);
+
+//Funcao para a desmontagem do sistema de arquivos montado em prefix. Nao podem
+//haver arquivos ou diretorios abertos nele, e a raiz so' e' desmontada apos
+//os demais pontos de montagem. Retorna 0 caso bem sucedido e -1
+//caso contrario
+int vfsUnmount (const char *prefix);
+
+//Funcao para a desmontagem de todos os pontos de montagem, exceto a raiz.
+//Retorna 0 caso todos tenham sido desmontados e -1 caso contrario
+int vfsUnmountAll ( void );
+
+//Funcao que verifica se um disco esta' montado em algum ponto de montagem.
+//Retorna 1 se montado e 0 caso contrario
+int vfsDiskIsMounted (Disk *d);
+
+//Funcao para gravar no disco os dados pendentes de todos os sistemas de
+//arquivos montados. Os discos sao atendidos em paralelo. Retorna 0 caso bem
+//sucedido e -1 caso contrario
+int vfsSync ( void );
+
 //Funcao para formatacao de um disco com o sistema de arquivos indicado pelo
 //identificador do sistema de arquivos (fsId), com tamanho de blocos igual a
 //blockSize. Retorna o numero total de blocos disponiveis no disco, se
@@ -137,6 +175,11 @@ int vfsRead (int fd, char *buf, unsigned int nbytes);
 //de sucesso ou -1, caso contrario
 int vfsWrite (int fd, const char *buf, unsigned int nbytes);
 
+//Funcao para reduzir para size bytes um arquivo, a partir de um descritor de
+//arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso contrario
+//(inclusive se o sistema de arquivos nao suportar a operacao)
+int vfsTruncate (int fd, unsigned int size);
+
 //Funcao para fechar um arquivo, a partir de um descritor de arquivo existente.
 //Retorna 0 caso bem sucedido, ou -1 caso contrario
 int vfsClose (int fd);
@@ -180,4 +223,11 @@ int vfsUnregisterFS (char fsId);
 //Escreve na saida padrao as informacoes sobre sistemas de arquivos registrados
 void vfsDumpFSInfo (void);
 
+//Escreve na saida padrao a tabela de pontos de montagem
+void vfsDumpMounts (void);
+
+//Escreve na saida padrao os contadores de E/S e os histogramas de latencia
+//dos discos montados
+void vfsDumpDiskStats (void);
+
 #endif